@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "riscvsim.h"
+#include "asm/lexer.h"
+
+/*
+   Throughput benchmarks for the simulator and the assembler. Each
+   workload is a generated program that is run to completion through
+   the embedding API, with and without the cache model. The results are
+   printed as JSON so that runs can be compared by scripts.
+*/
+
+// Instructions per slice passed to `rvsim_run`
+#define SLICE 1000000
+
+// Times the assembler is run over the generated source
+#define ASM_REPEAT 20
+
+// Cache used by the workloads with the cache model enabled
+static const RvSimCacheConfig bench_cache = { 32768, 64, 4, RVSIM_LRU, RVSIM_WRITEBACK, 1 };
+
+// Tight loop of register-register arithmetic
+static const char *alu_src =
+    "lui x5, 0x300\n"              // 3M iterations
+    "addi x6, x0, 1\n"
+    "loop:\n"
+    "    add x7, x7, x6\n"
+    "    xor x8, x8, x7\n"
+    "    slli x9, x7, 3\n"
+    "    srli x10, x8, 2\n"
+    "    or x11, x9, x10\n"
+    "    sub x12, x11, x6\n"
+    "    addi x6, x6, 3\n"
+    "    addi x5, x5, -1\n"
+    "    bne x5, x0, loop\n"
+    "end: add x0, x0, x0\n";
+
+// Loads and stores walking a 256 KB array with a 72-byte stride
+static const char *stride_src =
+    ".data\n"
+    ".dword 0\n"
+    ".text\n"
+    "lui x5, 0x100\n"              // 1M iterations
+    "lui x20, 0x10\n"              // Array start
+    "lui x21, 0x4f\n"              // Last block that the stride can reach
+    "add x12, x20, x0\n"
+    "loop:\n"
+    "    ld x7, 0(x12)\n"
+    "    addi x7, x7, 1\n"
+    "    sd x7, 8(x12)\n"
+    "    addi x12, x12, 72\n"
+    "    blt x12, x21, next\n"
+    "    add x12, x20, x0\n"
+    "next:\n"
+    "    addi x5, x5, -1\n"
+    "    bne x5, x0, loop\n"
+    "end: add x0, x0, x0\n";
+
+// Loads and stores at xorshift-generated addresses in a 256 KB array
+static const char *random_src =
+    ".data\n"
+    ".dword 0\n"
+    ".text\n"
+    "lui x5, 0x100\n"              // 1M iterations
+    "lui x20, 0x10\n"              // Array start
+    "lui x21, 0x40\n"
+    "addi x21, x21, -8\n"          // Mask for 8-byte aligned offsets
+    "addi x22, x0, 1234\n"         // RNG state
+    "loop:\n"
+    "    slli x23, x22, 13\n"
+    "    xor x22, x22, x23\n"
+    "    srli x23, x22, 7\n"
+    "    xor x22, x22, x23\n"
+    "    slli x23, x22, 17\n"
+    "    xor x22, x22, x23\n"
+    "    and x12, x22, x21\n"
+    "    add x12, x12, x20\n"
+    "    ld x7, 0(x12)\n"
+    "    addi x7, x7, 1\n"
+    "    sd x7, 0(x12)\n"
+    "    addi x5, x5, -1\n"
+    "    bne x5, x0, loop\n"
+    "end: add x0, x0, x0\n";
+
+// Naive recursive fibonacci, dominated by calls, returns and stack traffic
+static const char *recursion_src =
+    "lui sp, 0x50\n"
+    "addi a0, x0, 27\n"
+    "jal ra, fib\n"
+    "beq x0, x0, end\n"
+    "fib:\n"
+    "    addi t0, x0, 2\n"
+    "    blt a0, t0, fib_base\n"
+    "    addi sp, sp, -24\n"
+    "    sd ra, 0(sp)\n"
+    "    sd a0, 8(sp)\n"
+    "    addi a0, a0, -1\n"
+    "    jal ra, fib\n"
+    "    sd a0, 16(sp)\n"
+    "    ld a0, 8(sp)\n"
+    "    addi a0, a0, -2\n"
+    "    jal ra, fib\n"
+    "    ld t1, 16(sp)\n"
+    "    add a0, a0, t1\n"
+    "    ld ra, 0(sp)\n"
+    "    addi sp, sp, 24\n"
+    "fib_base:\n"
+    "    jalr x0, 0(ra)\n"
+    "end: add x0, x0, x0\n";
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Runs one workload to completion and prints its JSON object
+static void bench_workload(const char *name, const char *src, int cache, int last) {
+    RvSim *s = rvsim_create();
+    if (cache) rvsim_set_cache(s, &bench_cache);
+    if (rvsim_load(s, src, strlen(src)) != 0) {
+        fprintf(stderr, "%s: %s", name, rvsim_error(s));
+        exit(1);
+    }
+
+    double start = now();
+    while (rvsim_run(s, SLICE) == RVSIM_LIMIT);
+    double seconds = now() - start;
+
+    RvSimStats stats;
+    rvsim_get_stats(s, &stats);
+    rvsim_destroy(s);
+
+    printf("    {\"name\": \"%s\", \"cache\": %s, \"instructions\": %lu, \"seconds\": %.6f, "
+        "\"mips\": %.2f, \"cache_accesses\": %zu, \"cache_accesses_per_sec\": %.0f}%s\n",
+        name, cache? "true": "false", stats.instructions, seconds,
+        stats.instructions / seconds / 1e6, stats.accesses,
+        stats.accesses / seconds, last? "": ",");
+}
+
+// Generates a large source that fills most of the text segment, with
+// labels, comments and every instruction format
+static char *generate_source(size_t *num_lines) {
+    static const char *body[] = {
+        "    add x5, x6, x7",
+        "    addi t0, t1, -42",
+        "    ld a0, 16(sp)",
+        "    sd a1, 24(sp) ; spill",
+        "    slli s2, s3, 5",
+        "    bne a2, a3, L%d",
+        "    lui x10, 0x12345",
+        "    xor s4, s5, s6",
+        "    jal ra, L%d",
+        "    sltiu t4, t5, 0x7f",
+    };
+    int n = sizeof(body) / sizeof(body[0]);
+
+    size_t cap = 1 << 20, len = 0;
+    char *src = malloc(cap);
+    *num_lines = 0;
+
+    for (int i = 0; i < 15000; i++) {
+        if (cap - len < 256) {
+            cap *= 2;
+            src = realloc(src, cap);
+        }
+        if (i % 16 == 0) {
+            len += sprintf(&src[len], "L%d:\n; block %d\n", i / 16, i / 16);
+            *num_lines += 2;
+        }
+        len += sprintf(&src[len], body[i % n], i / 16);
+        src[len++] = '\n';
+        *num_lines += 1;
+    }
+    src[len] = '\0';
+    return src;
+}
+
+// Times the assembler over the generated source, with separate passes
+// or in a single pass, on `threads` threads
+static void bench_assembler(const char *name, int one_pass, int threads) {
+    size_t lines;
+    char *src = generate_source(&lines);
+    size_t len = strlen(src);
+    RvSim *s = rvsim_create();
+    rvsim_set_one_pass(s, one_pass);
+    rvsim_set_asm_threads(s, threads);
+
+    double start = now();
+    for (int i = 0; i < ASM_REPEAT; i++) {
+        if (rvsim_load(s, src, len) != 0) {
+            fprintf(stderr, "assembler: %s", rvsim_error(s));
+            exit(1);
+        }
+    }
+    double seconds = now() - start;
+
+    rvsim_destroy(s);
+    free(src);
+
+    printf("  \"%s\": {\"lines\": %zu, \"bytes\": %zu, \"seconds\": %.6f, "
+        "\"lines_per_sec\": %.0f, \"bytes_per_sec\": %.0f},\n",
+        name, lines * ASM_REPEAT, len * ASM_REPEAT, seconds,
+        lines * ASM_REPEAT / seconds, len * ASM_REPEAT / seconds);
+}
+
+// Times the lexer alone over the generated source, with or without
+// SIMD scanning
+static void bench_lexer(const char *name, int simd) {
+    size_t lines, tokens = 0;
+    char *src = generate_source(&lines);
+    size_t len = strlen(src);
+    lexer_use_simd(simd);
+
+    double start = now();
+    for (int i = 0; i < ASM_REPEAT; i++) {
+        Lexer l;
+        lexer_init(&l, src, len);
+        while (lexer_next(&l).type != TOK_EOF) tokens++;
+    }
+    double seconds = now() - start;
+    lexer_use_simd(1);
+    free(src);
+
+    printf("  \"%s\": {\"tokens\": %zu, \"bytes\": %zu, \"seconds\": %.6f, "
+        "\"tokens_per_sec\": %.0f, \"bytes_per_sec\": %.0f},\n",
+        name, tokens, len * ASM_REPEAT, seconds, tokens / seconds, len * ASM_REPEAT / seconds);
+}
+
+int main(void) {
+    printf("{\n  \"workloads\": [\n");
+    bench_workload("alu", alu_src, 0, 0);
+    bench_workload("stride", stride_src, 0, 0);
+    bench_workload("stride", stride_src, 1, 0);
+    bench_workload("random", random_src, 0, 0);
+    bench_workload("random", random_src, 1, 0);
+    bench_workload("recursion", recursion_src, 0, 0);
+    bench_workload("recursion", recursion_src, 1, 1);
+    printf("  ],\n");
+
+    bench_assembler("assembler", 0, 1);
+    bench_assembler("assembler_one_pass", 1, 1);
+    bench_assembler("assembler_4_threads", 0, 4);
+    bench_lexer("lexer", 1);
+    bench_lexer("lexer_scalar", 0);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("  \"peak_rss_kb\": %ld\n}\n", usage.ru_maxrss);
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef ARENA_H
+#include "arena.h"
+#endif
+
+// Size of the first block. Each new block is at least twice as large
+// as the one before it, so a load makes O(log n) calls to malloc.
+#define ARENA_MIN_BLOCK (64 * 1024)
+
+// Rounds allocations up so that every pointer is 16-byte aligned
+#define ARENA_ROUND(n) (((n) + 15) & ~(size_t)15)
+
+// Returns `n` bytes of uninitialized memory that live until `arena_free`
+void *arena_alloc(Arena *a, size_t n) {
+	n = ARENA_ROUND(n);
+	ArenaBlock *b = a->head;
+	if (!b || b->cap - b->used < n) {
+		size_t cap = b? 2 * b->cap: ARENA_MIN_BLOCK;
+		if (cap < n) cap = n;
+		b = malloc(sizeof(ArenaBlock) + cap);
+		b->prev = a->head;
+		b->cap = cap;
+		b->used = 0;
+		a->head = b;
+	}
+	void *ptr = &b->data[b->used];
+	b->used += n;
+	return ptr;
+}
+
+// Resizes an allocation, like `realloc`. The newest allocation is
+// extended in place when its block has room; anything else is copied.
+void *arena_grow(Arena *a, void *ptr, size_t old_size, size_t new_size) {
+	ArenaBlock *b = a->head;
+	if (ptr && b && (unsigned char*)ptr + ARENA_ROUND(old_size) == &b->data[b->used]) {
+		size_t start = (unsigned char*)ptr - b->data;
+		if (ARENA_ROUND(new_size) <= b->cap - start) {
+			b->used = start + ARENA_ROUND(new_size);
+			return ptr;
+		}
+	}
+	void *p = arena_alloc(a, new_size);
+	if (ptr) memcpy(p, ptr, old_size < new_size? old_size: new_size);
+	return p;
+}
+
+// Copies `n` bytes of `s` into a NUL-terminated arena string
+char *arena_strndup(Arena *a, const char *s, size_t n) {
+	char *str = arena_alloc(a, n + 1);
+	memcpy(str, s, n);
+	str[n] = '\0';
+	return str;
+}
+
+// Moves every block of `other` into `a`, which then frees them. Lets
+// threads allocate from their own arenas and hand the results over.
+void arena_adopt(Arena *a, Arena *other) {
+	if (!other->head) return;
+	ArenaBlock *oldest = other->head;
+	while (oldest->prev) oldest = oldest->prev;
+	oldest->prev = a->head;
+	a->head = other->head;
+	other->head = NULL;
+}
+
+// Releases every block of the arena
+void arena_free(Arena *a) {
+	ArenaBlock *b = a->head;
+	while (b) {
+		ArenaBlock *prev = b->prev;
+		free(b);
+		b = prev;
+	}
+	a->head = NULL;
+}
@@ -0,0 +1,22 @@
+#define ARENA_H
+
+#include <stddef.h>
+
+// A chunk of arena memory. Blocks are chained newest first.
+typedef struct ArenaBlock {
+	struct ArenaBlock *prev;
+	size_t cap, used;
+	_Alignas(16) unsigned char data[];
+} ArenaBlock;
+
+// Owns every allocation made while assembling one program. Nothing is
+// freed individually; `arena_free` releases all of it at once.
+typedef struct Arena {
+	ArenaBlock *head;
+} Arena;
+
+void *arena_alloc(Arena *a, size_t n);
+void *arena_grow(Arena *a, void *ptr, size_t old_size, size_t new_size);
+char *arena_strndup(Arena *a, const char *s, size_t n);
+void arena_adopt(Arena *a, Arena *other);
+void arena_free(Arena *a);
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifndef EMITTER_H
@@ -9,7 +10,7 @@
 
 // Returns the address that a label points to
 // Throws an error if label is not found.
-int get_label_pos(LabelVec *labels, Label label, EmitErr *err) {
+int get_label_pos(Arena *a, LabelVec *labels, Label label, EmitErr *err) {
     for (int i = 0; i < labels->len; i++) {
         if (strcmp(labels->data[i].lbl_name, label.name) == 0) {
             return labels->data[i].offset;
@@ -17,13 +18,14 @@ int get_label_pos(LabelVec *labels, Label label, EmitErr *err) {
     }
 
     err->is_err = 1;
-    err->msg = malloc(100 * sizeof(char));
-    sprintf(err->msg, "Label not found: %s", label.name);
+    size_t n = strlen(label.name) + 18;
+    err->msg = arena_alloc(a, n);
+    snprintf(err->msg, n, "Label not found: %s", label.name);
     return -1;
 }
 
 // Returns the hex code corresponding to an instruction
-int encode_ins(ParseNode *p, LabelVec *labels, int pc, EmitErr *err) {
+int encode_ins(Arena *a, ParseNode *p, LabelVec *labels, int pc, EmitErr *err) {
     int hex, imm;
     switch (p->type) {
         case R_INS:
@@ -39,7 +41,7 @@ int encode_ins(ParseNode *p, LabelVec *labels, int pc, EmitErr *err) {
         case I_INS:
             // If immediate is a label, resolve its address
             if (p->data.i.imm.is_label) {
-                imm = get_label_pos(labels, p->data.i.imm.data.l, err);
+                imm = get_label_pos(a, labels, p->data.i.imm.data.l, err);
                 if (err->is_err) {
                     err->line = p->line;    
                     return -1;
@@ -83,7 +85,7 @@ int encode_ins(ParseNode *p, LabelVec *labels, int pc, EmitErr *err) {
         case S_INS:
             // If immediate is a label, resolve its address
             if (p->data.s.imm.is_label) {
-                imm = get_label_pos(labels, p->data.s.imm.data.l, err);
+                imm = get_label_pos(a, labels, p->data.s.imm.data.l, err);
                 if (err->is_err) {
                     err->line = p->line;    
                     return -1;
@@ -111,7 +113,7 @@ int encode_ins(ParseNode *p, LabelVec *labels, int pc, EmitErr *err) {
         case B_INS:
             // If immediate is a label, resolve its address
             if (p->data.b.imm.is_label) {
-                imm = get_label_pos(labels, p->data.b.imm.data.l, err) - pc;
+                imm = get_label_pos(a, labels, p->data.b.imm.data.l, err) - pc;
                 if (err->is_err) {
                     err->line = p->line;    
                     return -1;
@@ -150,7 +152,7 @@ int encode_ins(ParseNode *p, LabelVec *labels, int pc, EmitErr *err) {
         case U_INS:
             // If immediate is a label, resolve its address
             if (p->data.u.imm.is_label) {
-                imm = get_label_pos(labels, p->data.u.imm.data.l, err);
+                imm = get_label_pos(a, labels, p->data.u.imm.data.l, err);
                 if (err->is_err) {
                     err->line = p->line;    
                     return -1;
@@ -175,7 +177,7 @@ int encode_ins(ParseNode *p, LabelVec *labels, int pc, EmitErr *err) {
         case J_INS:
             // If immediate is a label, resolve its address
             if (p->data.s.imm.is_label) {
-                imm = get_label_pos(labels, p->data.b.imm.data.l, err) - pc;
+                imm = get_label_pos(a, labels, p->data.b.imm.data.l, err) - pc;
                 if (err->is_err) {
                     err->line = p->line;    
                     return -1;
@@ -207,13 +209,11 @@ int encode_ins(ParseNode *p, LabelVec *labels, int pc, EmitErr *err) {
     return hex;
 }
 
-// Enumerates 
-void emit_all(uint8_t *buf, ParseNode p[], int num_nodes, LabelVec *labels, EmitErr *err) {
-    // Emit instructions
-    int pc = 0;
+// Encodes the instructions among `p` into `buf`, the first of them at `pc`
+void emit_range(Arena *a, uint8_t *buf, ParseNode p[], int num_nodes, int pc, LabelVec *labels, EmitErr *err) {
     for (int i = 0; i < num_nodes; i++) {
         if (p[i].type != LABEL) {
-            int ins = encode_ins(&p[i], labels, pc, err);
+            int ins = encode_ins(a, &p[i], labels, pc, err);
             *(uint32_t*)(&buf[pc]) = ins;
 
             if (err->is_err) return;
@@ -222,34 +222,47 @@ void emit_all(uint8_t *buf, ParseNode p[], int num_nodes, LabelVec *labels, Emit
     }
 }
 
-void find_labels(ParseNode p[], int num_nodes, LabelVec *labels, EmitErr *err) { 
-    int offset = 0;
-    for (int i = 0; i < num_nodes; i++) {
-        // Resize label vec if out of space
-        if (labels->cap == labels->len) {
-            labels->data = realloc(labels->data, (labels->cap + LE_CHUNK_SIZE) * sizeof(LabelEntry));
-            labels->cap += LE_CHUNK_SIZE;
+// Enumerates 
+void emit_all(Arena *a, uint8_t *buf, ParseNode p[], int num_nodes, LabelVec *labels, EmitErr *err) {
+    // Emit instructions
+    emit_range(a, buf, p, num_nodes, 0, labels, err);
+}
+
+// Adds a label defined at `offset`, unless one with the same name exists
+static void add_label(Arena *a, LabelVec *labels, ParseNode *p, int offset, EmitErr *err) {
+    for (int j = 0; j < labels->len; j++) {
+        if (strcmp(labels->data[j].lbl_name, p->data.l.name) == 0) {
+            err->is_err = 1;
+            err->msg = "Duplicate definition of label";
+            err->line = p->line;
+            return;
         }
+    }
 
-        if (p[i].type == LABEL) {
-            for (int j = 0; j < labels->len; j++) {
-                if (strcmp(labels->data[j].lbl_name, p[i].data.l.name) == 0) {
-                    err->is_err = 1;
-                    err->msg = "Duplicate definition of label";
-                    err->line = p[i].line;
-                    return;
-                }
-            }
+    // Resize label vec if out of space
+    if (labels->cap == labels->len) {
+        int cap = labels->cap? 2 * labels->cap: LE_CHUNK_SIZE;
+        labels->data = arena_grow(a, labels->data, labels->cap * sizeof(LabelEntry), cap * sizeof(LabelEntry));
+        labels->cap = cap;
+    }
+
+    labels->data[labels->len].lbl_name = p->data.l.name;
+    labels->data[labels->len++].offset = offset;
+}
 
-            labels->data[labels->len].lbl_name = p[i].data.l.name;
-            labels->data[labels->len++].offset = offset;
+void find_labels(Arena *a, ParseNode p[], int num_nodes, LabelVec *labels, EmitErr *err) {
+    int offset = 0;
+    for (int i = 0; i < num_nodes; i++) {
+        if (p[i].type == LABEL) {
+            add_label(a, labels, &p[i], offset, err);
+            if (err->is_err) return;
         } else {
             offset += 4;
         }
     }
 
     // Check for label at end of file, not followed by an instruction
-    if (labels->data[labels->len-1].offset == offset) {
+    if (labels->len && labels->data[labels->len-1].offset == offset) {
         err->is_err = 1;
         err->msg = "Label without instruction";
         err->line = p[num_nodes-1].line;
@@ -257,4 +270,108 @@ void find_labels(ParseNode p[], int num_nodes, LabelVec *labels, EmitErr *err) {
     }
 
     return;
-}
\ No newline at end of file
+}
+
+// Does the instruction's immediate name a label?
+static int refers_to_label(ParseNode *p) {
+    switch (p->type) {
+        case I_INS: return p->data.i.imm.is_label;
+        case S_INS: return p->data.s.imm.is_label;
+        case B_INS: return p->data.b.imm.is_label;
+        case U_INS: return p->data.u.imm.is_label;
+        case J_INS: return p->data.j.imm.is_label;
+        default: return 0;
+    }
+}
+
+// Encodes one instruction into `buf`, if it fits, and keeps the first
+// error in program order in `first`
+static void emit_one(Arena *a, uint8_t *buf, size_t buf_len, ParseNode *p, LabelVec *labels,
+        int pc, EmitErr *first, int *first_pc) {
+    EmitErr err = {0, "", 0};
+    int ins = encode_ins(a, p, labels, pc, &err);
+    if (pc + 4 <= buf_len) *(uint32_t*)(&buf[pc]) = ins;
+
+    if (err.is_err && (!first->is_err || pc < *first_pc)) {
+        *first = err;
+        *first_pc = pc;
+    }
+}
+
+/*
+   Assembles in a single pass: each instruction is encoded into `buf` as
+   soon as it is parsed, so no array of parse nodes is kept. Instructions
+   whose immediate names a label are saved as fixups and encoded once
+   every label has been seen. Instructions past `buf_len` are counted
+   but not written.
+
+   Errors take the same precedence as with the separate passes: parse
+   errors, then label definitions, then the first instruction that fails
+   to encode.
+*/
+void assemble(Parser *p, uint8_t *buf, size_t buf_len, DataVec *d, LabelVec *labels,
+        LineVec *lines, ParseErr *perr, EmitErr *err) {
+    Arena *a = p->arena;
+    ParseNodeVec pn = {0};
+    FixupVec fixups = {0};
+    EmitErr label_err = {0, "", 0}, ins_err = {0, "", 0};
+    int ins_err_pc = 0, last_line = 0;
+
+    while (1) {
+        pn.len = 0;
+        parse_one(p, &pn, d, perr);
+        if (perr->is_err) {
+            // Reaching the end of the file ends the program
+            if (strcmp(perr->msg, "EOF while parsing") != 0) return;
+            perr->is_err = 0;
+            break;
+        }
+        if (pn.len == 0) continue;
+
+        ParseNode *node = &pn.data[0];
+        int pc = 4 * lines->len;
+        last_line = node->line;
+
+        if (node->type == LABEL) {
+            if (!label_err.is_err) add_label(a, labels, node, pc, &label_err);
+            continue;
+        }
+
+        if (lines->cap == lines->len) {
+            lines->cap = lines->cap? 2 * lines->cap: 1024;
+            lines->data = realloc(lines->data, lines->cap * sizeof(int));
+        }
+        lines->data[lines->len++] = node->line;
+
+        if (refers_to_label(node)) {
+            if (fixups.cap == fixups.len) {
+                size_t cap = fixups.cap? 2 * fixups.cap: 1024;
+                fixups.data = arena_grow(a, fixups.data, fixups.cap * sizeof(Fixup), cap * sizeof(Fixup));
+                fixups.cap = cap;
+            }
+            fixups.data[fixups.len].node = *node;
+            fixups.data[fixups.len++].pc = pc;
+        } else {
+            emit_one(a, buf, buf_len, node, labels, pc, &ins_err, &ins_err_pc);
+        }
+    }
+
+    if (label_err.is_err) {
+        *err = label_err;
+        return;
+    }
+
+    // Check for label at end of file, not followed by an instruction
+    if (labels->len && labels->data[labels->len-1].offset == 4 * lines->len) {
+        err->is_err = 1;
+        err->msg = "Label without instruction";
+        err->line = last_line;
+        return;
+    }
+
+    // Patch the instructions that refer to labels
+    for (size_t i = 0; i < fixups.len; i++) {
+        emit_one(a, buf, buf_len, &fixups.data[i].node, labels, fixups.data[i].pc, &ins_err, &ins_err_pc);
+    }
+    if (ins_err.is_err) *err = ins_err;
+}
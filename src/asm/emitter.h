@@ -20,5 +20,26 @@ typedef struct EmitErr {
     int line;
 } EmitErr;
 
-void find_labels(ParseNode p[], int num_nodes, LabelVec *labels, EmitErr *err);
-void emit_all(uint8_t *buf, ParseNode p[], int num_nodes, LabelVec *labels, EmitErr *err);
\ No newline at end of file
+// An instruction whose immediate names a label. It is encoded once all
+// labels are known.
+typedef struct Fixup {
+    ParseNode node;
+    int pc;
+} Fixup;
+
+typedef struct FixupVec {
+    size_t len, cap;
+    Fixup *data;
+} FixupVec;
+
+// Source line of each assembled instruction
+typedef struct LineVec {
+    size_t len, cap;
+    int *data;
+} LineVec;
+
+void find_labels(Arena *a, ParseNode p[], int num_nodes, LabelVec *labels, EmitErr *err);
+void emit_range(Arena *a, uint8_t *buf, ParseNode p[], int num_nodes, int pc, LabelVec *labels, EmitErr *err);
+void emit_all(Arena *a, uint8_t *buf, ParseNode p[], int num_nodes, LabelVec *labels, EmitErr *err);
+void assemble(Parser *p, uint8_t *buf, size_t buf_len, DataVec *d, LabelVec *labels,
+    LineVec *lines, ParseErr *perr, EmitErr *err);
\ No newline at end of file
@@ -1,170 +1,270 @@
 #include "lexer.h"
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 
-
-// Used to construct single character tokens
-#define TOK(kind) { Span s = {start, l->pos}; Token t = {kind, s}; return t; }
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define LEXER_X86 1
+#endif
 
 /*
-   Advances the lexer while the current character (c)
-   meets a certain predicate.
-
-   Implementing this as a macro allowed direct substitution
-   of the predicate expression instead of having to call
-   a function for every character. This led to a 25%
-   performance increase. 
+   Characters are classified with a 256-entry table rather than chained
+   comparisons. Past their first few bytes, the runs that make up most
+   of a source (whitespace, identifiers and comments) are scanned 16
+   bytes at a time with SSE2, which every x86-64 CPU has, and then 32
+   at a time with AVX2 if the CPU supports it. Elsewhere, and past the
+   last full block of the source, the table is used one byte at a time.
 */
-#define LEXER_TAKE(predicate) { \
-	size_t start = l->pos;        \
-	char c;                       \
-	while ((c=lexer_current(l)))  \
-	if(predicate)                 \
-	lexer_advance(l);             \
-	else                          \
-	break;                        \
-	s.end = l->pos;               \
+
+// Character classes, combined as bits in `char_class`
+enum {
+	CC_SPACE = 1 << 0,   // ' ' and '\t'
+	CC_DEC = 1 << 1,
+	CC_BIN = 1 << 2,
+	CC_HEX = 1 << 3,     // Digits and lowercase 'a' to 'f'
+	CC_OCT = 1 << 4,
+	CC_START = 1 << 5,   // Letters and '_', which start identifiers
+	CC_IDENT = 1 << 6,   // Letters, digits and '_'
+	CC_COMMENT = 1 << 7, // Everything but '\n' and '\0', which end comments
+};
+
+static const uint8_t char_class[256] = {
+	[0x01 ... 0x08] = CC_COMMENT,
+	['\t'] = CC_COMMENT | CC_SPACE,
+	[0x0b ... 0x1f] = CC_COMMENT,
+	[' '] = CC_COMMENT | CC_SPACE,
+	['!' ... '/'] = CC_COMMENT,
+	['0' ... '1'] = CC_COMMENT | CC_DEC | CC_BIN | CC_HEX | CC_OCT | CC_IDENT,
+	['2' ... '7'] = CC_COMMENT | CC_DEC | CC_HEX | CC_OCT | CC_IDENT,
+	['8' ... '9'] = CC_COMMENT | CC_DEC | CC_HEX | CC_IDENT,
+	[':' ... '@'] = CC_COMMENT,
+	['A' ... 'Z'] = CC_COMMENT | CC_START | CC_IDENT,
+	['[' ... '^'] = CC_COMMENT,
+	['_'] = CC_COMMENT | CC_START | CC_IDENT,
+	['`'] = CC_COMMENT,
+	['a' ... 'f'] = CC_COMMENT | CC_HEX | CC_START | CC_IDENT,
+	['g' ... 'z'] = CC_COMMENT | CC_START | CC_IDENT,
+	['{' ... 0xff] = CC_COMMENT,
+};
+
+// Scanning with SSE2 and AVX2, both off without x86-64
+static int use_sse2, use_avx2;
+
+// Returns the character at `pos`, or '\0' past the end of the source
+#define CHAR_AT(pos) (((pos) < len)? (uint8_t)src[pos]: 0)
+
+// Returns the first position from `pos` whose character is not in `cls`
+static inline size_t scan_scalar(const char *src, size_t pos, size_t len, uint8_t cls) {
+	while (pos < len && (char_class[(uint8_t)src[pos]] & cls)) pos++;
+	return pos;
+}
+
+#ifdef LEXER_X86
+
+// Each `*_stop` function returns a mask with bit i set if byte i of a
+// block ends the run
+
+static inline uint32_t sse2_space_stop(__m128i v) {
+	__m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+	return ~_mm_movemask_epi8(space) & 0xffff;
+}
+
+// Setting bit 5 folds uppercase letters onto lowercase ones. Bytes above
+// 0x7f compare as negative, so they fall outside both ranges.
+static inline uint32_t sse2_ident_stop(__m128i v) {
+	__m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), lower));
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), v));
+	__m128i under = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+	return ~_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), under)) & 0xffff;
+}
+
+static inline uint32_t sse2_comment_stop(__m128i v) {
+	return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_setzero_si128())));
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t avx2_space_stop(__m256i v) {
+	__m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+	return ~(uint32_t)_mm256_movemask_epi8(space);
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t avx2_ident_stop(__m256i v) {
+	__m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+	__m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+	__m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+	__m256i under = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+	return ~(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(alpha, digit), under));
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t avx2_comment_stop(__m256i v) {
+	return _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+}
+
+// Defines `avx2_<name>`, which scans 32 bytes at a time and finishes
+// with the table
+#define SCAN_AVX2(name, cls) \
+__attribute__((target("avx2"))) \
+static size_t avx2_##name(const char *src, size_t pos, size_t len) { \
+	for (; pos + 32 <= len; pos += 32) { \
+		uint32_t m = avx2_##name##_stop(_mm256_loadu_si256((const __m256i*)&src[pos])); \
+		if (m) return pos + __builtin_ctz(m); \
+	} \
+	return scan_scalar(src, pos, len, cls); \
+}
+
+SCAN_AVX2(space, CC_SPACE)
+SCAN_AVX2(ident, CC_IDENT)
+SCAN_AVX2(comment, CC_COMMENT)
+
+// Defines `scan_<name>`, which returns the end of a run of characters
+// in `cls` that continues from `pos`. Most runs are a few bytes long,
+// so the first 4 bytes are checked with the table. Longer runs are
+// scanned with SSE2, and from the second block on with AVX2.
+#define SCAN(name, cls) \
+static inline size_t scan_##name(const char *src, size_t pos, size_t len) { \
+	for (size_t end = pos + 4; pos < end; pos++) { \
+		if (pos >= len || !(char_class[(uint8_t)src[pos]] & cls)) return pos; \
+	} \
+	if (use_sse2) { \
+		for (; pos + 16 <= len; pos += 16) { \
+			uint32_t m = sse2_##name##_stop(_mm_loadu_si128((const __m128i*)&src[pos])); \
+			if (m) return pos + __builtin_ctz(m); \
+			if (use_avx2) return avx2_##name(src, pos + 16, len); \
+		} \
+	} \
+	return scan_scalar(src, pos, len, cls); \
+}
+
+SCAN(space, CC_SPACE)
+SCAN(ident, CC_IDENT)
+SCAN(comment, CC_COMMENT)
+
+#else
+
+#define scan_space(src, pos, len) scan_scalar(src, pos, len, CC_SPACE)
+#define scan_ident(src, pos, len) scan_scalar(src, pos, len, CC_IDENT)
+#define scan_comment(src, pos, len) scan_scalar(src, pos, len, CC_COMMENT)
+
+#endif
+
+// Enables or disables SIMD scanning. AVX2 is only used if the CPU has
+// it. SIMD scanning is on by default.
+void lexer_use_simd(int enabled) {
+#ifdef LEXER_X86
+	__builtin_cpu_init();
+	use_sse2 = enabled;
+	use_avx2 = enabled && __builtin_cpu_supports("avx2");
+#else
+	(void)enabled;
+#endif
+}
+
+__attribute__((constructor))
+static void lexer_select_scanner(void) {
+	lexer_use_simd(1);
 }
 
 // Initializes the lexer
-void lexer_init(Lexer* l, char* src) {
+void lexer_init(Lexer* l, char* src, size_t len) {
 	l->src = src;
+	l->len = len;
 	l->pos = 0;
 	l->line = 1;
 	l->lastline = -1;
 }
 
-// Returns the current charater.
-// Inlining improves performance (~20%)
-char lexer_current(Lexer* l) {
-	return l->src[l->pos];
+// Ends the token that started at `start` before `end`
+#define TOKEN(kind, end) { \
+	l->pos = (end);        \
+	Token t = { kind, { start, l->pos } }; \
+	return t;              \
 }
 
-// Advances the lexer to the next character
-// Inlining improves performance (~20%)
-void lexer_advance(Lexer* l) {
-	l->pos++;
-}
-
-// Checks if the current character falls into some character classes
-// To be used with LEXER_TAKE
-#define IS_WHITESPACE(c) ((c) == ' ' || (c) == '\t')
-#define IS_DECDIGIT(c) ((c) >= '0' && (c) <= '9')
-#define IS_BINDIGIT(c) ((c) == '0' || (c) == '1')
-#define IS_HEXDIGIT(c) ((c) >= '0' && (c) <= '9' || (c) >= 'a' && (c) <= 'f')
-#define IS_OCTDIGIT(c) ((c) >= '0' && (c) <= '7')
-#define IS_ALPHA(c) (((c) >= 'A' && (c) <= 'Z') || ((c) >= 'a' && (c) <= 'z'))
-#define IS_IDENTCHAR(c) (IS_DECDIGIT(c) || IS_ALPHA(c) || (c) == '_')
-
 // Returns the next token
 Token lexer_next(Lexer *l) {
-	size_t start = l->pos;
-	char c = lexer_current(l);
-	Span s = { start, start };
-
-	// Newlines
-	if (c == '\n') {
-		l->line++;
-		l->lastline = l->pos;
-		lexer_advance(l);
-		return lexer_next(l);
-	}	
-
-	// Whitespace
-	if (IS_WHITESPACE(c)) {
-		LEXER_TAKE(IS_WHITESPACE(c));
-		return lexer_next(l);
-	}
+	const char *src = l->src;
+	size_t len = l->len, pos = l->pos;
 
-	// Identitifiers
-	if (IS_ALPHA(c) || c == '_') {
-		LEXER_TAKE(IS_IDENTCHAR(c));
-		Token t = { TOK_IDENT, s };
-		return t;
-	}
+	while (1) {
+		size_t start = pos;
+		uint8_t c = CHAR_AT(pos);
+		uint8_t cls = char_class[c];
 
-	// Numeric literals
-	// First check for leading minus sign
-	int flag = 0;
-	if (c == '-') {
-		lexer_advance(l);
-		flag = 1;
-	}
+		// Newlines
+		if (c == '\n') {
+			l->line++;
+			l->lastline = pos;
+			pos++;
+			continue;
+		}
 
-	// Check for base specifiers like 0x, 0b, etc
-	c = lexer_current(l);
-	if (c == '0') {
-		lexer_advance(l);
-		switch(lexer_current(l)) {
-		// Hexadecimal
-		case 'x': {
-			lexer_advance(l);
-			
-			c = lexer_current(l);
-			if (!IS_HEXDIGIT(c)) {
-				TOK(TOK_ERR);	
-			}
-			
-			LEXER_TAKE(IS_HEXDIGIT(c));
-			Token t = { TOK_HEXNUM, s };
-			return t;
+		// Whitespace
+		if (cls & CC_SPACE) {
+			pos = scan_space(src, pos + 1, len);
+			continue;
 		}
-		// Binary
-		case 'b': {
-			lexer_advance(l);
-			
-			c = lexer_current(l);
-			if (!IS_BINDIGIT(c)) {
-				TOK(TOK_ERR);	
-			}
-			
-			LEXER_TAKE(IS_BINDIGIT(c));
-			Token t = { TOK_BINNUM, s };
-			return t;
+
+		// Comments run until the end of the line
+		if (c == ';') {
+			pos = scan_comment(src, pos + 1, len);
+			continue;
 		}
-		// Octal (also handles the literal '0')
-		default:
-			LEXER_TAKE(IS_OCTDIGIT(c));
-			Token t = { TOK_OCTNUM, s };
-			return t;
+
+		// Identifiers
+		if (cls & CC_START) TOKEN(TOK_IDENT, scan_ident(src, pos + 1, len));
+
+		// Numeric literals, with an optional leading minus sign
+		if (c == '-') {
+			pos++;
+			c = CHAR_AT(pos);
+			if (!(char_class[c] & CC_DEC)) TOKEN(TOK_ERR, pos);
 		}
-	} else if (IS_DECDIGIT(c)) {
-		// Decimal numbers
-		LEXER_TAKE(IS_DECDIGIT(c));
-		Token t = { TOK_DECNUM, s };
-		return t;
-	} else if (flag) {
-		// Minus sign without any digits after it
-		TOK(TOK_ERR);
-	}
 
-	// Single character tokens
-	lexer_advance(l);
-	switch (c) {
-		// Directives like '.data', '.text', etc
-		case '.':
-			LEXER_TAKE(IS_IDENTCHAR(c));
-			Token t = { TOK_DIRECTIVE, s };
-			return t;
-		case '\0':
-			TOK(TOK_EOF);
-		case ',':
-			TOK(TOK_COMMA);
-		case ':':
-			TOK(TOK_COLON);
-		case '(':
-			TOK(TOK_LPAREN);
-		case ')':
-			TOK(TOK_RPAREN);	
-		case ';':
-			// If there is a comment, ignore all characters until end of line
-			// and return the token after thar
-			LEXER_TAKE((c != '\n'));			
-			return lexer_next(l);
-		default:
-			// Syntax error for invalid characters
-			TOK(TOK_ERR);
+		// Check for base specifiers like 0x, 0b, etc
+		if (c == '0') {
+			pos++;
+			switch (CHAR_AT(pos)) {
+			// Hexadecimal
+			case 'x':
+				pos++;
+				if (!(char_class[CHAR_AT(pos)] & CC_HEX)) TOKEN(TOK_ERR, pos);
+				TOKEN(TOK_HEXNUM, scan_scalar(src, pos, len, CC_HEX));
+			// Binary
+			case 'b':
+				pos++;
+				if (!(char_class[CHAR_AT(pos)] & CC_BIN)) TOKEN(TOK_ERR, pos);
+				TOKEN(TOK_BINNUM, scan_scalar(src, pos, len, CC_BIN));
+			// Octal (also handles the literal '0')
+			default:
+				TOKEN(TOK_OCTNUM, scan_scalar(src, pos, len, CC_OCT));
+			}
+		} else if (char_class[c] & CC_DEC) {
+			// Decimal numbers
+			TOKEN(TOK_DECNUM, scan_scalar(src, pos, len, CC_DEC));
+		}
+
+		// Single character tokens
+		switch (c) {
+			// Directives like '.data', '.text', etc
+			case '.':
+				TOKEN(TOK_DIRECTIVE, scan_ident(src, pos + 1, len));
+			case '\0':
+				TOKEN(TOK_EOF, pos + 1);
+			case ',':
+				TOKEN(TOK_COMMA, pos + 1);
+			case ':':
+				TOKEN(TOK_COLON, pos + 1);
+			case '(':
+				TOKEN(TOK_LPAREN, pos + 1);
+			case ')':
+				TOKEN(TOK_RPAREN, pos + 1);
+			default:
+				// Syntax error for invalid characters
+				TOKEN(TOK_ERR, pos + 1);
+		}
 	}
 }
-
-
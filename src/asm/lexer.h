@@ -19,10 +19,12 @@ typedef struct Token {
 	Span span;	
 } Token;
 
+// Lexes `len` bytes of `src`, which does not need to be NUL-terminated
 typedef struct Lexer {
 	char *src;
-	size_t pos, line, lastline;
+	size_t len, pos, line, lastline;
 } Lexer;
 
-void lexer_init(Lexer* l, char *src);
+void lexer_init(Lexer* l, char *src, size_t len);
 Token lexer_next(Lexer *l);
+void lexer_use_simd(int enabled);
@@ -0,0 +1,48 @@
+#ifndef LOOKUP_H
+#include "lookup.h"
+#endif
+
+#ifndef TABLES_H
+#include "tables.h"
+#endif
+
+#include <string.h>
+
+/*
+   Mnemonics and register names are found with perfect hash tables, so
+   each lookup is one hash and one string comparison instead of a scan
+   over every table. The slot arrays in lookup_table.h are generated from
+   the tables in tables.c by `make lookup-table`, which has to be rerun
+   whenever an entry is added.
+*/
+
+#include "lookup_table.h"
+
+// Is the `len`-byte token `s` exactly `key`?
+static int key_eq(const char *key, const char *s, size_t len) {
+	return strncmp(key, s, len) == 0 && key[len] == '\0';
+}
+
+// Returns the mnemonic's slot, or NULL if `s` is not a mnemonic
+const MnemonicSlot *lookup_mnemonic(const char *s, size_t len) {
+	const MnemonicSlot *m = &mnemonic_slots[lookup_hash(s, len, MNEMONIC_MULT, MNEMONIC_BITS)];
+	const char *key;
+	switch (m->format) {
+	case FMT_R: key = r_ins_table[m->index].key; break;
+	case FMT_I: key = i_ins_table[m->index].key; break;
+	case FMT_I2: key = i_ins_table_2[m->index].key; break;
+	case FMT_S: key = s_ins_table[m->index].key; break;
+	case FMT_B: key = b_ins_table[m->index].key; break;
+	case FMT_U: key = u_ins_table[m->index].key; break;
+	case FMT_J: key = j_ins_table[m->index].key; break;
+	default: return NULL;
+	}
+	return key_eq(key, s, len)? m: NULL;
+}
+
+// Returns the register number (0-31) named by `s`, or -1
+int lookup_register(const char *s, size_t len) {
+	int i = register_slots[lookup_hash(s, len, REGISTER_MULT, REGISTER_BITS)];
+	if (i == 0 || !key_eq(reg_table[i - 1].key, s, len)) return -1;
+	return reg_table[i - 1].value;
+}
@@ -0,0 +1,27 @@
+#define LOOKUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Instruction table a mnemonic belongs to. `FMT_NONE` marks an empty
+// slot in the hash table.
+typedef enum InsFormat {
+	FMT_NONE, FMT_R, FMT_I, FMT_I2, FMT_S, FMT_B, FMT_U, FMT_J
+} InsFormat;
+
+// A mnemonic's table and its index within that table
+typedef struct MnemonicSlot {
+	uint8_t format, index;
+} MnemonicSlot;
+
+// Multiplicative hash of a token's text. The top `bits` bits of the
+// result index the lookup tables; `mult` is picked by `make lookup-table`
+// so that no two keys of a table share a slot.
+static inline uint32_t lookup_hash(const char *s, size_t len, uint32_t mult, int bits) {
+	uint32_t h = 0;
+	for (size_t i = 0; i < len; i++) h = (h ^ (uint8_t) s[i]) * mult;
+	return h >> (32 - bits);
+}
+
+const MnemonicSlot *lookup_mnemonic(const char *s, size_t len);
+int lookup_register(const char *s, size_t len);
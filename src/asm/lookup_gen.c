@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef LOOKUP_H
+#include "lookup.h"
+#endif
+
+#ifndef TABLES_H
+#include "tables.h"
+#endif
+
+/*
+   Generates lookup_table.h: searches for a hash multiplier under which
+   every mnemonic (and, separately, every register name) lands in its own
+   slot, then prints the slot arrays. Run through `make lookup-table`.
+*/
+
+#define MNEMONIC_BITS 7
+#define REGISTER_BITS 8
+
+typedef struct Key {
+	const char *key;
+	int format, index;
+} Key;
+
+// Tries multipliers until none of the keys collide. Fills `slots` with
+// the index of the key in each slot plus one.
+static uint32_t find_mult(const Key *keys, int n, int bits, int *slots) {
+	uint32_t mult = 0x9e3779b1;
+	for (long tries = 0; tries < 100000000; tries++) {
+		mult = mult * 1664525 + 1013904223;
+		mult |= 1;
+		memset(slots, 0, sizeof(int) << bits);
+		int i;
+		for (i = 0; i < n; i++) {
+			uint32_t h = lookup_hash(keys[i].key, strlen(keys[i].key), mult, bits);
+			if (slots[h]) break;
+			slots[h] = i + 1;
+		}
+		if (i == n) return mult;
+	}
+	fprintf(stderr, "No perfect hash found, increase the table size\n");
+	exit(1);
+}
+
+int main(void) {
+	static const char *names[] = { "", "FMT_R", "FMT_I", "FMT_I2", "FMT_S", "FMT_B", "FMT_U", "FMT_J" };
+	Key mnemonics[256], registers[256];
+	int n = 0;
+
+#define ADD_KEYS(table, len, fmt) \
+	for (int i = 0; i < len; i++) mnemonics[n++] = (Key) { table[i].key, fmt, i };
+	ADD_KEYS(r_ins_table, r_ins_table_len, FMT_R)
+	ADD_KEYS(i_ins_table, i_ins_table_len, FMT_I)
+	ADD_KEYS(i_ins_table_2, i_ins_table_2_len, FMT_I2)
+	ADD_KEYS(s_ins_table, s_ins_table_len, FMT_S)
+	ADD_KEYS(b_ins_table, b_ins_table_len, FMT_B)
+	ADD_KEYS(u_ins_table, u_ins_table_len, FMT_U)
+	ADD_KEYS(j_ins_table, j_ins_table_len, FMT_J)
+#undef ADD_KEYS
+	for (int i = 0; i < reg_table_len; i++) registers[i] = (Key) { reg_table[i].key, 0, i };
+
+	int slots[1 << REGISTER_BITS];
+	printf("// Generated by `make lookup-table` from the tables in tables.c\n");
+
+	uint32_t mult = find_mult(mnemonics, n, MNEMONIC_BITS, slots);
+	printf("#define MNEMONIC_MULT 0x%08xu\n#define MNEMONIC_BITS %d\n\n", mult, MNEMONIC_BITS);
+	printf("static const MnemonicSlot mnemonic_slots[1 << MNEMONIC_BITS] = {\n");
+	for (int h = 0; h < 1 << MNEMONIC_BITS; h++) {
+		if (!slots[h]) continue;
+		const Key *k = &mnemonics[slots[h] - 1];
+		printf("\t[%d] = { %s, %d }, // %s\n", h, names[k->format], k->index, k->key);
+	}
+	printf("};\n\n");
+
+	mult = find_mult(registers, reg_table_len, REGISTER_BITS, slots);
+	printf("#define REGISTER_MULT 0x%08xu\n#define REGISTER_BITS %d\n\n", mult, REGISTER_BITS);
+	printf("// Index into `reg_table` plus one, zero if the slot is empty\n");
+	printf("static const uint8_t register_slots[1 << REGISTER_BITS] = {\n");
+	for (int h = 0; h < 1 << REGISTER_BITS; h++) {
+		if (!slots[h]) continue;
+		printf("\t[%d] = %d, // %s\n", h, slots[h], registers[slots[h] - 1].key);
+	}
+	printf("};\n");
+	return 0;
+}
@@ -0,0 +1,118 @@
+// Generated by `make lookup-table` from the tables in tables.c
+#define MNEMONIC_MULT 0x2416e995u
+#define MNEMONIC_BITS 7
+
+static const MnemonicSlot mnemonic_slots[1 << MNEMONIC_BITS] = {
+	[1] = { FMT_I2, 1 }, // lh
+	[3] = { FMT_I, 3 }, // xori
+	[4] = { FMT_S, 0 }, // sb
+	[6] = { FMT_R, 1 }, // sub
+	[8] = { FMT_B, 4 }, // bltu
+	[10] = { FMT_I2, 4 }, // lbu
+	[13] = { FMT_I, 0 }, // addi
+	[15] = { FMT_I, 6 }, // slli
+	[18] = { FMT_R, 3 }, // slt
+	[19] = { FMT_B, 1 }, // bne
+	[24] = { FMT_S, 1 }, // sh
+	[30] = { FMT_I, 8 }, // srai
+	[34] = { FMT_R, 2 }, // sll
+	[35] = { FMT_I, 2 }, // ori
+	[39] = { FMT_R, 8 }, // or
+	[40] = { FMT_I, 4 }, // slti
+	[54] = { FMT_I2, 0 }, // lb
+	[56] = { FMT_I, 5 }, // sltiu
+	[59] = { FMT_I, 7 }, // srli
+	[61] = { FMT_I2, 6 }, // lwu
+	[62] = { FMT_B, 5 }, // bgeu
+	[64] = { FMT_B, 2 }, // blt
+	[67] = { FMT_U, 1 }, // auipc
+	[69] = { FMT_R, 9 }, // and
+	[74] = { FMT_I2, 3 }, // ld
+	[75] = { FMT_S, 2 }, // sw
+	[77] = { FMT_R, 5 }, // xor
+	[79] = { FMT_I, 1 }, // andi
+	[81] = { FMT_R, 6 }, // srl
+	[82] = { FMT_R, 0 }, // add
+	[88] = { FMT_I2, 5 }, // lhu
+	[93] = { FMT_J, 0 }, // jal
+	[94] = { FMT_I2, 7 }, // jalr
+	[95] = { FMT_I2, 2 }, // lw
+	[96] = { FMT_S, 3 }, // sd
+	[103] = { FMT_R, 7 }, // sra
+	[108] = { FMT_U, 0 }, // lui
+	[112] = { FMT_R, 4 }, // sltu
+	[118] = { FMT_B, 3 }, // bge
+	[120] = { FMT_B, 0 }, // beq
+};
+
+#define REGISTER_MULT 0x810806b1u
+#define REGISTER_BITS 8
+
+// Index into `reg_table` plus one, zero if the slot is empty
+static const uint8_t register_slots[1 << REGISTER_BITS] = {
+	[2] = 34, // x0
+	[5] = 36, // x2
+	[7] = 38, // x4
+	[9] = 40, // x6
+	[16] = 5, // tp
+	[23] = 65, // x31
+	[35] = 63, // x29
+	[41] = 57, // x23
+	[43] = 55, // x21
+	[45] = 61, // x27
+	[47] = 59, // x25
+	[51] = 53, // x19
+	[57] = 10, // fp
+	[59] = 45, // x11
+	[61] = 47, // x13
+	[63] = 49, // x15
+	[65] = 51, // x17
+	[67] = 1, // zero
+	[74] = 32, // t5
+	[79] = 7, // t1
+	[81] = 30, // t3
+	[83] = 13, // a1
+	[84] = 28, // s10
+	[85] = 15, // a3
+	[87] = 17, // a5
+	[89] = 19, // a7
+	[97] = 20, // s2
+	[99] = 9, // s0
+	[101] = 24, // s6
+	[103] = 22, // s4
+	[108] = 26, // s8
+	[123] = 43, // x9
+	[132] = 35, // x1
+	[134] = 37, // x3
+	[136] = 39, // x5
+	[138] = 41, // x7
+	[152] = 64, // x30
+	[162] = 62, // x28
+	[163] = 4, // gp
+	[165] = 3, // sp
+	[168] = 56, // x22
+	[170] = 54, // x20
+	[172] = 60, // x26
+	[174] = 58, // x24
+	[180] = 52, // x18
+	[188] = 44, // x10
+	[190] = 46, // x12
+	[192] = 48, // x14
+	[194] = 50, // x16
+	[197] = 2, // ra
+	[201] = 31, // t4
+	[203] = 33, // t6
+	[206] = 6, // t0
+	[208] = 8, // t2
+	[212] = 12, // a0
+	[213] = 29, // s11
+	[214] = 14, // a2
+	[216] = 16, // a4
+	[218] = 18, // a6
+	[224] = 21, // s3
+	[226] = 11, // s1
+	[228] = 25, // s7
+	[230] = 23, // s5
+	[235] = 27, // s9
+	[250] = 42, // x8
+};
@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifndef PARALLEL_H
+#include "parallel.h"
+#endif
+
+/*
+   Large sources are split at line boundaries and the chunks are lexed
+   and parsed on their own threads. A chunk's section depends on the
+   `.text` and `.data` directives before it, so every chunk is first
+   parsed as text; the merge then walks the chunks in order and parses
+   again the few whose section turns out to be data. Line numbers are
+   made global by adding the number of lines before each chunk.
+
+   An element could continue over a chunk boundary, since newlines are
+   only whitespace to the lexer. Such a chunk ends or begins with an
+   error, so whenever any chunk fails the whole source is parsed again
+   serially, which also reports exactly the error `parse_all` would.
+*/
+
+typedef struct ParseChunk {
+	pthread_t thread;
+	char *src;
+	size_t len, lines;
+	int start_text, end_text; // Section at the start and the end
+	int last;                 // Ends at the end of the source
+	Arena arena;
+	ParseNodeVec pn;
+	DataVec d;
+	ParseErr err;
+} ParseChunk;
+
+// Parses one chunk, starting in the section given by `start_text`
+static void parse_chunk(ParseChunk *c) {
+	Lexer l;
+	Parser p;
+	lexer_init(&l, c->src, c->len);
+	parser_init(&p, &l, &c->arena);
+	p.text_section = c->start_text;
+
+	c->pn.len = c->d.len = 0;
+	c->err.is_err = 0;
+	while (p.current.type != TOK_EOF) {
+		parse_one(&p, &c->pn, &c->d, &c->err);
+		if (c->err.is_err) {
+			// Like `parse_all`, an element cut off by the end of the
+			// source is dropped. Anywhere else it may continue in the
+			// next chunk.
+			if (c->last && strcmp(c->err.msg, "EOF while parsing") == 0) {
+				c->pn.len--;
+				c->err.is_err = 0;
+			}
+			break;
+		}
+	}
+	c->lines = l.line - 1;
+	c->end_text = p.text_section;
+}
+
+static void *parse_worker(void *arg) {
+	parse_chunk(arg);
+	return NULL;
+}
+
+// Parses the source like `parse_all`, splitting it over up to
+// `num_threads` threads. Everything allocated ends up in `a`.
+void parse_parallel(Arena *a, char *src, size_t len, int num_threads,
+	ParseNodeVec *pn, DataVec *d, ParseErr *err) {
+	int n = len / ASM_MIN_CHUNK;
+	if (n > num_threads) n = num_threads;
+	if (n < 1) n = 1;
+
+	// Split after the first newline past each multiple of the chunk size
+	ParseChunk *chunks = calloc(n, sizeof(ParseChunk));
+	size_t start = 0;
+	int num_chunks = 0;
+	for (int i = 0; i < n && start < len; i++) {
+		size_t end = len, target = len / n * (i + 1);
+		if (i < n - 1) {
+			if (target < start) target = start;
+			char *nl = memchr(&src[target], '\n', len - target);
+			if (nl) end = nl - src + 1;
+		}
+		ParseChunk *c = &chunks[num_chunks++];
+		c->src = &src[start];
+		c->len = end - start;
+		c->start_text = 1;
+		c->last = (end == len);
+		c->d.max = d->max;
+		start = end;
+	}
+
+	for (int i = 1; i < num_chunks; i++) {
+		pthread_create(&chunks[i].thread, NULL, parse_worker, &chunks[i]);
+	}
+	parse_chunk(&chunks[0]);
+	for (int i = 1; i < num_chunks; i++) {
+		pthread_join(chunks[i].thread, NULL);
+	}
+
+	// Fix up the sections in order, then check for errors
+	int text = 1, failed = 0;
+	size_t num_nodes = 0, data_len = 0;
+	for (int i = 0; i < num_chunks && !failed; i++) {
+		ParseChunk *c = &chunks[i];
+		if (c->start_text != text) {
+			c->start_text = text;
+			parse_chunk(c);
+		}
+		// A source that ends in the data section is an error for
+		// `parse_all`, which the serial parse reproduces
+		failed = c->err.is_err || (c->last && !c->end_text);
+		text = c->end_text;
+		num_nodes += c->pn.len;
+		data_len += c->d.len;
+	}
+
+	if (failed) {
+		Lexer l;
+		Parser p;
+		lexer_init(&l, src, len);
+		parser_init(&p, &l, a);
+		parse_all(&p, pn, d, err);
+	} else {
+		// Concatenate the chunks with their lines made global
+		pn->data = arena_alloc(a, num_nodes * sizeof(ParseNode));
+		pn->len = pn->cap = num_nodes;
+		// The data goes into `d`'s own buffer if it has one
+		if (!d->data) {
+			d->data = arena_alloc(a, data_len);
+			d->cap = data_len;
+		}
+		d->len = data_len;
+
+		size_t node = 0, byte = 0, line = 0;
+		for (int i = 0; i < num_chunks; i++) {
+			ParseChunk *c = &chunks[i];
+			for (size_t j = 0; j < c->pn.len; j++) {
+				pn->data[node] = c->pn.data[j];
+				pn->data[node++].line += line;
+			}
+			size_t n = (c->d.len < c->d.cap)? c->d.len: c->d.cap;
+			if (byte < d->cap) memcpy(&d->data[byte], c->d.data, (n < d->cap - byte)? n: d->cap - byte);
+			byte += c->d.len;
+			line += c->lines;
+		}
+	}
+
+	// Label names in the nodes point into the chunks' arenas
+	for (int i = 0; i < num_chunks; i++) {
+		arena_adopt(a, &chunks[i].arena);
+	}
+	free(chunks);
+}
+
+typedef struct EmitRange {
+	pthread_t thread;
+	ParseNode *p;
+	int num_nodes, pc;
+	uint8_t *buf;
+	LabelVec *labels;
+	Arena arena;
+	EmitErr err;
+} EmitRange;
+
+static void *emit_worker(void *arg) {
+	EmitRange *r = arg;
+	emit_range(&r->arena, r->buf, r->p, r->num_nodes, r->pc, r->labels, &r->err);
+	return NULL;
+}
+
+// Encodes the instructions like `emit_all`, splitting the nodes into
+// `num_threads` ranges. The error reported is the first in program order.
+void emit_parallel(Arena *a, uint8_t *buf, ParseNode p[], int num_nodes, LabelVec *labels,
+	int num_threads, EmitErr *err) {
+	if (num_threads < 1) num_threads = 1;
+	EmitRange *ranges = calloc(num_threads, sizeof(EmitRange));
+
+	int first = 0, pc = 0;
+	for (int i = 0; i < num_threads; i++) {
+		EmitRange *r = &ranges[i];
+		int last = (long) num_nodes * (i + 1) / num_threads;
+		r->p = &p[first];
+		r->num_nodes = last - first;
+		r->pc = pc;
+		r->buf = buf;
+		r->labels = labels;
+		r->err = (EmitErr) {0, "", 0};
+		for (int j = first; j < last; j++) {
+			if (p[j].type != LABEL) pc += 4;
+		}
+		first = last;
+	}
+
+	for (int i = 1; i < num_threads; i++) {
+		pthread_create(&ranges[i].thread, NULL, emit_worker, &ranges[i]);
+	}
+	emit_worker(&ranges[0]);
+	for (int i = 1; i < num_threads; i++) {
+		pthread_join(ranges[i].thread, NULL);
+	}
+
+	for (int i = 0; i < num_threads; i++) {
+		if (ranges[i].err.is_err && !err->is_err) *err = ranges[i].err;
+		arena_adopt(a, &ranges[i].arena);
+	}
+	free(ranges);
+}
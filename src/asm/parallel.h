@@ -0,0 +1,13 @@
+#define PARALLEL_H
+
+#ifndef EMITTER_H
+#include "emitter.h"
+#endif
+
+// Sources are only split if every chunk gets at least this many bytes
+#define ASM_MIN_CHUNK (64 * 1024)
+
+void parse_parallel(Arena *a, char *src, size_t len, int num_threads,
+	ParseNodeVec *pn, DataVec *d, ParseErr *err);
+void emit_parallel(Arena *a, uint8_t *buf, ParseNode p[], int num_nodes, LabelVec *labels,
+	int num_threads, EmitErr *err);
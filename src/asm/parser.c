@@ -2,24 +2,13 @@
 #include "parser.h"
 #endif
 
+#ifndef LOOKUP_H
+#include "lookup.h"
+#endif
+
 #include <string.h>
 #include <stdio.h>
-
-#include "tables.c"
-
-// Does `a` start with `b`?
-// Assumes that a is longer than b
-int startswith(char *a, char *b) {
-	int i = 0;
-	char c1 = a[i], c2 = b[i];
-	while(c2) {
-		if (c1 != c2) return 0;
-		i++;
-		c1 = a[i];
-		c2 = b[i];
-	}
-	return 1;
-}
+#include <limits.h>
 
 // Converts a token type to a human readable string
 // Used for error reporting
@@ -41,8 +30,9 @@ char *token_type_to_str(TokenType tt) {
 }
 
 // Initializes the parser
-void parser_init(Parser *p, Lexer *l) {
+void parser_init(Parser *p, Lexer *l, Arena *arena) {
 	p->lexer = l;
+	p->arena = arena;
 	p->src = l->src;
 	p->current = lexer_next(l);
 	p->text_section = 1;
@@ -77,8 +67,8 @@ void parser_expect(Parser *p, TokenType tt, ParseErr *err) {
 		TokenType cur = p->current.type;
 		if (cur != tt) {
 			err->is_err = 1; 
-			err->msg = malloc(50 * sizeof(char));
-			sprintf(err->msg, "Expected %s, got %s", token_type_to_str(tt), token_type_to_str(p->current.type));
+			err->msg = arena_alloc(p->arena, 64);
+			snprintf(err->msg, 64, "Expected %s, got %s", token_type_to_str(tt), token_type_to_str(p->current.type));
 			err->line = p->lexer->line;
 			err->scol = p->current.span.start - p->lexer->lastline;
 			err->ecol = p->current.span.end - p->lexer->lastline;
@@ -89,17 +79,17 @@ void parser_expect(Parser *p, TokenType tt, ParseErr *err) {
 
 // Checks if the token test of the current token is equal to `str`
 int parser_tteq(Parser *p, char *str) {
-	return startswith(&p->src[p->current.span.start], str)
-		&& (strlen(str) == (p->current.span.end - p->current.span.start));
+	size_t n = p->current.span.end - p->current.span.start;
+	return strncmp(&p->src[p->current.span.start], str, n) == 0 && str[n] == '\0';
 }
 
 // Parses a register into its register number (0-31)
 int parse_register(Parser *p, ParseErr *err) {
-	for (int i = 0; i < sizeof(reg_table)/sizeof(RegTableEntry); i++) {
-		if (parser_tteq(p, reg_table[i].key)) {
-			parser_advance(p, err);	
-			return reg_table[i].value;
-		}
+	int reg = lookup_register(&p->src[p->current.span.start],
+		p->current.span.end - p->current.span.start);
+	if (reg >= 0) {
+		parser_advance(p, err);
+		return reg;
 	}
 
 	// THrow an error if none of the register names match
@@ -111,40 +101,56 @@ int parse_register(Parser *p, ParseErr *err) {
 	return -1;
 }
 
+// Converts the text of a number token, which the lexer has already
+// checked, to its value. Like strtoul, a leading minus sign negates the
+// value and values that overflow saturate, but the conversion stops at
+// the end of the token rather than at the first non-digit.
+static unsigned long number_value(const char *s, size_t n, int base) {
+	int negative = (*s == '-');
+	s += negative;
+	n -= negative;
+	if (base != 10 && base != 8) {
+		// Skip the `0x` or `0b` prefix
+		s += 2;
+		n -= 2;
+	}
+
+	unsigned long v = 0;
+	for (size_t i = 0; i < n; i++) {
+		unsigned digit = (s[i] <= '9')? s[i] - '0': s[i] - 'a' + 10;
+		if (v > (ULONG_MAX - digit) / base) return ULONG_MAX;
+		v = v * base + digit;
+	}
+	return negative? -v: v;
+}
+
+// Returns the base of a number token, or 0 for other tokens
+static int token_base(TokenType tt) {
+	switch (tt) {
+	case TOK_DECNUM: return 10;
+	case TOK_HEXNUM: return 16;
+	case TOK_OCTNUM: return 8;
+	case TOK_BINNUM: return 2;
+	default: return 0;
+	}
+}
+
 // Parses a number
 unsigned long parse_number(Parser *p, ParseErr *err) {
-    char *end;
-	unsigned long n;
-
-    switch (p->current.type) {
-    case TOK_DECNUM:
-        n = strtoul(&p->src[p->current.span.start], &end, 10);
-        parser_advance(p, err);
-		return n;
-    case TOK_HEXNUM:
-        n = strtoul(&p->src[p->current.span.start], &end, 16);
-        parser_advance(p, err);
-		return n;
-	case TOK_OCTNUM:
-        n = strtoul(&p->src[p->current.span.start], &end, 8);
-        parser_advance(p, err);
-		return n;
-	case TOK_BINNUM: ;
-		// strtol doesn't handle `0b` syntax, so we parse the minus
-		// sign ourselves and use strtol for everything after `0b`. 
-		int negative = (p->src[p->current.span.start] == '-');	
-        n = strtoul(&p->src[p->current.span.start + 2 + negative], &end, 2);
-        parser_advance(p, err);
-        return negative? -n: n;
-	default:
+	int base = token_base(p->current.type);
+	if (!base) {
 		err->is_err = 1;
 		err->msg = "Invalid number";
 		err->line = p->lexer->line;
 		err->scol = p->current.span.start - p->lexer->lastline;
 		err->ecol = p->current.span.end - p->lexer->lastline;
 		return -1;
-    }
+	}
 
+	unsigned long n = number_value(&p->src[p->current.span.start],
+		p->current.span.end - p->current.span.start, base);
+	parser_advance(p, err);
+	return n;
 }
 
 // Parses a number or a label
@@ -152,9 +158,7 @@ NumOrLabel parse_number_or_label(Parser *p, ParseErr *err) {
     if (p->current.type == TOK_IDENT) {
 		// Copy label text into a string
         int n = p->current.span.end - p->current.span.start;
-        char *label = malloc((n+1) * sizeof(char));
-        strncpy(label, &p->src[p->current.span.start], n);
-        label[n] = '\0';
+        char *label = arena_strndup(p->arena, &p->src[p->current.span.start], n);
 
         NumOrLabel res = {
             1,
@@ -176,7 +180,7 @@ NumOrLabel parse_number_or_label(Parser *p, ParseErr *err) {
 }
 
 // Parses R-format instruction
-RIns parse_r_ins(Parser *p, RInsTableEntry *entry, ParseErr *err) {
+RIns parse_r_ins(Parser *p, const RInsTableEntry *entry, ParseErr *err) {
 	RIns ins = { entry, 0, 0, 0 };
 
 	ins.rd = parse_register(p, err);
@@ -197,7 +201,7 @@ RIns parse_r_ins(Parser *p, RInsTableEntry *entry, ParseErr *err) {
 }
 
 // Parses I-format arithmetic instruction
-IIns parse_i_ins(Parser *p, IInsTableEntry *entry, ParseErr *err) {
+IIns parse_i_ins(Parser *p, const IInsTableEntry *entry, ParseErr *err) {
 	IIns ins = { entry, 0, 0, 0 };
 	
 	ins.rd = parse_register(p, err);
@@ -219,7 +223,7 @@ IIns parse_i_ins(Parser *p, IInsTableEntry *entry, ParseErr *err) {
 }
 
 // Parses I-format load/jump instruction
-IIns parse_i_ins_2(Parser *p, IInsTableEntry *entry, ParseErr *err) {
+IIns parse_i_ins_2(Parser *p, const IInsTableEntry *entry, ParseErr *err) {
 	IIns ins = { entry, 0, 0, 0 };
     ins.rd = parse_register(p, err);
 	if (err->is_err) return ins;
@@ -243,7 +247,7 @@ IIns parse_i_ins_2(Parser *p, IInsTableEntry *entry, ParseErr *err) {
 }
 
 // Parses S-format instruction
-SIns parse_s_ins(Parser *p, SInsTableEntry *entry, ParseErr *err) {
+SIns parse_s_ins(Parser *p, const SInsTableEntry *entry, ParseErr *err) {
 	SIns ins = { entry, 0, 0, 0 };
 
 	ins.rs2 = parse_register(p, err);
@@ -268,7 +272,7 @@ SIns parse_s_ins(Parser *p, SInsTableEntry *entry, ParseErr *err) {
 }
 
 // Parses B-format instruction
-BIns parse_b_ins(Parser *p, BInsTableEntry *entry, ParseErr *err) {
+BIns parse_b_ins(Parser *p, const BInsTableEntry *entry, ParseErr *err) {
 	BIns ins = { entry, 0, 0, 0 };
 
 	ins.rs1 = parse_register(p, err);
@@ -290,7 +294,7 @@ BIns parse_b_ins(Parser *p, BInsTableEntry *entry, ParseErr *err) {
 }
 
 // Parses U-format instruction
-UIns parse_u_ins(Parser *p, UInsTableEntry *entry, ParseErr *err) {
+UIns parse_u_ins(Parser *p, const UInsTableEntry *entry, ParseErr *err) {
 	UIns ins = { entry, 0, 0 };
 	
 	ins.rd = parse_register(p, err);
@@ -306,7 +310,7 @@ UIns parse_u_ins(Parser *p, UInsTableEntry *entry, ParseErr *err) {
 }
 
 // Parses J-format instruction
-JIns parse_j_ins(Parser *p, JInsTableEntry *entry, ParseErr *err) {
+JIns parse_j_ins(Parser *p, const JInsTableEntry *entry, ParseErr *err) {
 	JIns ins = { entry, 0, 0 };
 	
 	ins.rd = parse_register(p, err);
@@ -326,109 +330,49 @@ ParseNode parse_text_element(Parser *p, ParseErr *err) {
 	ParseNode sentinel = {0}; // Zero object to be returned in case of error
 	int line = p->lexer->line;
 
-	// Checks if instruction is R-format and parses
-	for (int i = 0; i < sizeof(r_ins_table)/sizeof(RInsTableEntry); i++) {
-		if (parser_tteq(p, r_ins_table[i].key)) {
-			parser_advance(p, err);
-			if (err->is_err) return sentinel;
-			ParseNode node = {
-				R_INS,
-				{ .r = parse_r_ins(p, &r_ins_table[i], err) },
-				line,
-			};
-			return node;
-		}
-	}
-	
-	// Checks if instruction is I-format arithmetic and parses
-	for (int i = 0; i < sizeof(i_ins_table)/sizeof(IInsTableEntry); i++) {
-		if (parser_tteq(p, i_ins_table[i].key)) {
-			parser_advance(p, err);
-			if (err->is_err) return sentinel;
-			ParseNode node = {
-				I_INS,
-				{ .i = parse_i_ins(p, &i_ins_table[i], err) },
-				line,
-			};
-			return node;
-		}
-	}
-
-	// Checks if instruction is I-format memory/jump and parses.
-    for (int i = 0; i < sizeof(i_ins_table_2)/sizeof(IInsTableEntry); i++) {
-		if (parser_tteq(p, i_ins_table_2[i].key)) {
-			parser_advance(p, err);
-			if (err->is_err) return sentinel;
-			ParseNode node = {
-				I_INS,
-				{ .i = parse_i_ins_2(p, &i_ins_table_2[i], err) },
-				line,
-			};
-			return node;
-		}
-	}
-
-	// Checks if instruction is S-format and parses
-	for (int i = 0; i < sizeof(s_ins_table)/sizeof(SInsTableEntry); i++) {
-		if (parser_tteq(p, s_ins_table[i].key)) {
-			parser_advance(p, err);
-			if (err->is_err) return sentinel;
-			ParseNode node = {
-				S_INS,
-				{ .s = parse_s_ins(p, &s_ins_table[i], err) },
-				line,
-			};
-			return node;
-		}
-	}
-
-	// Checks if instruction is B-format and parses
-	for (int i = 0; i < sizeof(b_ins_table)/sizeof(BInsTableEntry); i++) {
-		if (parser_tteq(p, b_ins_table[i].key)) {
-			parser_advance(p, err);
-			if (err->is_err) return sentinel;
-			ParseNode node = {
-				B_INS,
-				{ .b = parse_b_ins(p, &b_ins_table[i], err) },
-				line,
-			};
-			return node;
-		}
-	}
-
-	// Checks if instruction is U-format and parses
-	for (int i = 0; i < sizeof(u_ins_table)/sizeof(UInsTableEntry); i++) {
-		if (parser_tteq(p, u_ins_table[i].key)) {
-			parser_advance(p, err);
-			if (err->is_err) return sentinel;
-			ParseNode node = {
-				U_INS,
-				{ .u = parse_u_ins(p, &u_ins_table[i], err) },
-				line,
-			};
-			return node;
-		}
-	}
-
-	// Checks if instruction is J-format and parses
-	for (int i = 0; i < sizeof(j_ins_table)/sizeof(JInsTableEntry); i++) {
-		if (parser_tteq(p, j_ins_table[i].key)) {
-			parser_advance(p, err);
-			if (err->is_err) return sentinel;
-			ParseNode node = {
-				J_INS,
-				{ .j = parse_j_ins(p, &j_ins_table[i], err) },
-				line,
-			};
-			return node;
+	// Finds the instruction's table and parses it in that format
+	const MnemonicSlot *m = lookup_mnemonic(&p->src[p->current.span.start],
+		p->current.span.end - p->current.span.start);
+	if (m) {
+		parser_advance(p, err);
+		if (err->is_err) return sentinel;
+		ParseNode node = { .line = line };
+		switch (m->format) {
+		case FMT_R:
+			node.type = R_INS;
+			node.data.r = parse_r_ins(p, &r_ins_table[m->index], err);
+			break;
+		case FMT_I:
+			node.type = I_INS;
+			node.data.i = parse_i_ins(p, &i_ins_table[m->index], err);
+			break;
+		case FMT_I2:
+			node.type = I_INS;
+			node.data.i = parse_i_ins_2(p, &i_ins_table_2[m->index], err);
+			break;
+		case FMT_S:
+			node.type = S_INS;
+			node.data.s = parse_s_ins(p, &s_ins_table[m->index], err);
+			break;
+		case FMT_B:
+			node.type = B_INS;
+			node.data.b = parse_b_ins(p, &b_ins_table[m->index], err);
+			break;
+		case FMT_U:
+			node.type = U_INS;
+			node.data.u = parse_u_ins(p, &u_ins_table[m->index], err);
+			break;
+		case FMT_J:
+			node.type = J_INS;
+			node.data.j = parse_j_ins(p, &j_ins_table[m->index], err);
+			break;
 		}
+		return node;
 	}
 
 	// Token might be a label. Copies text into a string
     int n = p->current.span.end - p->current.span.start;
-    char *label = malloc((n+1) * sizeof(char));
-    strncpy(label, &p->src[p->current.span.start], n);
-    label[n] = '\0';
+    char *label = arena_strndup(p->arena, &p->src[p->current.span.start], n);
  
     parser_advance(p, err);
 	if (err->is_err) return sentinel;
@@ -452,92 +396,124 @@ ParseNode parse_text_element(Parser *p, ParseErr *err) {
     return node;
 }
 
-// Parses one data directive and the values after it
-void parse_data_element(Parser *p, DataVec *d, ParseErr *err) {
-	if (parser_tteq(p, ".byte")) {
-		parser_advance(p, err);
-		if (err->is_err) return;
+// Makes room for `n` more bytes in the data segment, doubling its
+// capacity when it is full. Returns 0 if they would go past `d->max`.
+static int data_reserve(Parser *p, DataVec *d, size_t n) {
+	if (n > SIZE_MAX / 4 || (d->max && (d->len > d->max || d->max - d->len < n))) return 0;
+	if (d->cap - d->len >= n) return 1;
+
+	size_t cap = d->cap? 2 * d->cap: 1024;
+	while (cap - d->len < n) cap *= 2;
+	if (d->max && cap > d->max) cap = d->max;
+	d->data = arena_grow(p->arena, d->data, d->cap, cap);
+	d->cap = cap;
+	return 1;
+}
 
-		while (1) {
-			switch (p->current.type) {
-			
-			case TOK_BINNUM:
-			case TOK_HEXNUM:
-			case TOK_OCTNUM:
-			case TOK_DECNUM: ;
-				long n = parse_number(p, err);
-				if (err->is_err) return;
+// Appends `count` copies of the low `size` bytes of `value`. Copies are
+// doubled with memcpy rather than written one at a time.
+static void data_fill(Parser *p, DataVec *d, uint64_t value, size_t size, uint64_t count) {
+	if (count > (SIZE_MAX - d->len) / size) count = (SIZE_MAX - d->len) / size;
+	size_t n = size * count;
+	if (n && data_reserve(p, d, n)) {
+		uint8_t *out = &d->data[d->len];
+		if (value == 0 || size == 1) {
+			memset(out, value & 0xff, n);
+		} else {
+			memcpy(out, &value, size);
+			for (size_t done = size; done < n; done *= 2) {
+				memcpy(&out[done], out, (n - done < done)? n - done: done);
+			}
+		}
+	}
+	d->len += n;
+}
 
-				// If there is no space, grow the array
-				if (d->len - d->cap < 1) {
-					d->data = realloc(d->data, (d->cap + 1024) * sizeof(uint8_t));
-					d->cap += 1024;			
-				}
+// Reads `, <number>` pairs of a value list straight from the source,
+// after the lexer has read a number. Only decimal and hex numbers on the
+// same line are handled, which covers generated lists; at anything else
+// (including numbers that overflow) the lexer is left before it, and the
+// token-by-token loop takes over.
+static void data_fast_values(Parser *p, DataVec *d, size_t size) {
+	Lexer *l = p->lexer;
+	const char *src = l->src;
+	size_t len = l->len, pos = l->pos;
 
-				*(uint8_t*)(&d->data[d->len]) = n;
-				d->len += 1;
-				break;
-			case TOK_COMMA:
-				parser_advance(p, err);
-				if (err->is_err) return;
-				break;
-			default: 
-				return;	
+	while (1) {
+		size_t q = pos;
+		while (q < len && (src[q] == ' ' || src[q] == '\t')) q++;
+		if (q >= len || src[q] != ',') break;
+		q++;
+		while (q < len && (src[q] == ' ' || src[q] == '\t')) q++;
+
+		int negative = (q < len && src[q] == '-');
+		q += negative;
+		uint64_t v = 0;
+		if (q + 2 < len && src[q] == '0' && src[q + 1] == 'x') {
+			size_t digits = q += 2;
+			for (; q < len; q++) {
+				char c = src[q];
+				unsigned digit = (c >= '0' && c <= '9')? c - '0': (c >= 'a' && c <= 'f')? c - 'a' + 10: 16;
+				if (digit == 16 || v >> 60) break;
+				v = v * 16 + digit;
 			}
+			if (q == digits) break;
+		} else if (q < len && src[q] >= '1' && src[q] <= '9') {
+			for (; q < len && src[q] >= '0' && src[q] <= '9'; q++) {
+				unsigned digit = src[q] - '0';
+				if (v > (UINT64_MAX - digit) / 10) break;
+				v = v * 10 + digit;
+			}
+		} else if (q < len && src[q] == '0') {
+			q++;
+		} else {
+			break;
 		}
-	} else if (parser_tteq(p, ".half")) {
-		parser_advance(p, err);
-		if (err->is_err) return;
 
-		while (1) {
-			switch (p->current.type) {
-			
-			case TOK_BINNUM:
-			case TOK_HEXNUM:
-			case TOK_OCTNUM:
-			case TOK_DECNUM: ;
-				long n = parse_number(p, err);
-				if (err->is_err) return;
+		// The number has to end where the lexer would end it
+		if (q < len && src[q] != ' ' && src[q] != '\t' && src[q] != ',' && src[q] != '\n' && src[q] != ';') break;
 
-				// If there is no space, grow the array
-				if (d->len - d->cap < 2) {
-					d->data = realloc(d->data, (d->cap + 1024) * sizeof(uint8_t));
-					d->cap += 1024;			
-				}
+		if (negative) v = -v;
+		if (data_reserve(p, d, size)) memcpy(&d->data[d->len], &v, size);
+		d->len += size;
+		pos = q;
+	}
+	l->pos = pos;
+}
 
-				*(uint16_t*)(&d->data[d->len]) = n;
-				d->len += 2;
-				break;
-			case TOK_COMMA:
-				parser_advance(p, err);
-				if (err->is_err) return;
-				break;
-			default: 
-				return;	
-			}
-		}
-	} else if (parser_tteq(p, ".word")) {
+// Parses `, <number>` after the arguments of a directive, or returns
+// `value` if there is no comma
+static unsigned long parse_optional_number(Parser *p, unsigned long value, ParseErr *err) {
+	if (p->current.type != TOK_COMMA) return value;
+	parser_advance(p, err);
+	if (err->is_err) return value;
+	return parse_number(p, err);
+}
+
+// Parses one data directive and the values after it
+void parse_data_element(Parser *p, DataVec *d, ParseErr *err) {
+	size_t size = parser_tteq(p, ".byte")? 1: parser_tteq(p, ".half")? 2:
+		parser_tteq(p, ".word")? 4: parser_tteq(p, ".dword")? 8: 0;
+
+	if (size) {
+		// .byte/.half/.word/.dword <value>, ...
 		parser_advance(p, err);
 		if (err->is_err) return;
 
 		while (1) {
 			switch (p->current.type) {
-			
 			case TOK_BINNUM:
 			case TOK_HEXNUM:
 			case TOK_OCTNUM:
 			case TOK_DECNUM: ;
-				long n = parse_number(p, err);
-				if (err->is_err) return;
-
-				// If there is no space, grow the array
-				if (d->len - d->cap < 4) {
-					d->data = realloc(d->data, (d->cap + 1024) * sizeof(uint8_t));
-					d->cap += 1024;			
-				}
+				uint64_t n = number_value(&p->src[p->current.span.start],
+					p->current.span.end - p->current.span.start, token_base(p->current.type));
+				if (data_reserve(p, d, size)) memcpy(&d->data[d->len], &n, size);
+				d->len += size;
 
-				*(uint32_t*)(&d->data[d->len]) = n;
-				d->len += 4;
+				data_fast_values(p, d, size);
+				parser_advance(p, err);
+				if (err->is_err) return;
 				break;
 			case TOK_COMMA:
 				parser_advance(p, err);
@@ -547,42 +523,49 @@ void parse_data_element(Parser *p, DataVec *d, ParseErr *err) {
 				return;	
 			}
 		}
-	} else if (parser_tteq(p, ".dword")) {
+	} else if (parser_tteq(p, ".zero") || parser_tteq(p, ".space")) {
+		// .zero <count> or .space <count>[, <byte>]
+		int space = parser_tteq(p, ".space");
 		parser_advance(p, err);
 		if (err->is_err) return;
 
-		while (1) {
-			switch (p->current.type) {
-			
-			case TOK_BINNUM:
-			case TOK_HEXNUM:
-			case TOK_OCTNUM:
-			case TOK_DECNUM: ;
-				uint64_t n = parse_number(p, err);
-				if (err->is_err) return;
-
-				// If there is no space, grow the array
-				if (d->len - d->cap < 8) {
-					d->data = realloc(d->data, (d->cap + 1024) * sizeof(uint8_t));
-					d->cap += 1024;			
-				}
+		uint64_t count = parse_number(p, err);
+		if (err->is_err) return;
+		uint64_t value = space? parse_optional_number(p, 0, err): 0;
+		if (err->is_err) return;
+		data_fill(p, d, value, 1, count);
+	} else if (parser_tteq(p, ".fill")) {
+		// .fill <count>[, <size>[, <value>]], with a size of 1 to 8 bytes
+		parser_advance(p, err);
+		if (err->is_err) return;
 
-				*(uint64_t*)(&d->data[d->len]) = n;
-				d->len += 8;
-				break;
-			case TOK_COMMA:
-				parser_advance(p, err);
-				if (err->is_err) return;
-				break;
-			default: 
-				return;	
+		uint64_t count = parse_number(p, err);
+		if (err->is_err) return;
+		uint64_t fill_size = 1;
+		if (p->current.type == TOK_COMMA) {
+			parser_advance(p, err);
+			if (err->is_err) return;
+
+			Span span = p->current.span;
+			fill_size = parse_number(p, err);
+			if (err->is_err) return;
+			if (fill_size < 1 || fill_size > 8) {
+				err->is_err = 1;
+				err->line = p->lexer->line;
+				err->scol = span.start - p->lexer->lastline;
+				err->ecol = span.end - p->lexer->lastline;
+				err->msg = "Fill size must be between 1 and 8";
+				return;
 			}
 		}
+		uint64_t value = parse_optional_number(p, 0, err);
+		if (err->is_err) return;
+		data_fill(p, d, value, fill_size, count);
 	} else {
 		err->is_err = 1;
 		err->line = p->lexer->line;
-		err->scol = p->current.span.start;
-		err->ecol = p->current.span.end;
+		err->scol = p->current.span.start - p->lexer->lastline;
+		err->ecol = p->current.span.end - p->lexer->lastline;
 		err->msg = "Unknown token"; 
 		return;
 	}
@@ -607,8 +590,9 @@ void parse_one(Parser *p, ParseNodeVec *pn, DataVec *d, ParseErr *err) {
 
 	if (p->text_section) {
 		if (pn->cap == pn->len) {
-            pn->data = realloc(pn->data, (pn->cap + 1024) * sizeof(ParseNode));
-            pn->cap += 1024;
+			size_t cap = pn->cap? 2 * pn->cap: 1024;
+			pn->data = arena_grow(p->arena, pn->data, pn->cap * sizeof(ParseNode), cap * sizeof(ParseNode));
+			pn->cap = cap;
 		}
 
 		pn->data[pn->len++] = parse_text_element(p, err);
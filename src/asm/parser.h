@@ -10,11 +10,16 @@
 #include "tables.h"
 #endif
 
+#ifndef ARENA_H
+#include "arena.h"
+#endif
+
 typedef struct Parser {
 	Token current;
 	Lexer *lexer;
 	char *src;
 	int text_section;
+	Arena *arena; // Owns the nodes, label names and error messages
 } Parser;
 
 typedef struct Label {
@@ -30,36 +35,36 @@ typedef struct NumOrLabel {
 } NumOrLabel;
 
 typedef struct RIns {
-	RInsTableEntry *entry;
+	const RInsTableEntry *entry;
 	int rd, rs1, rs2;
 } RIns;
 
 typedef struct IIns {
-	IInsTableEntry *entry;
+	const IInsTableEntry *entry;
 	int rd, rs1;
 	NumOrLabel imm;
 } IIns;
 
 typedef struct SIns {
-	SInsTableEntry *entry;
+	const SInsTableEntry *entry;
 	int rs1, rs2;
 	NumOrLabel imm;	
 } SIns;
 
 typedef struct BIns {
-	BInsTableEntry *entry;
+	const BInsTableEntry *entry;
 	int rs1, rs2;
 	NumOrLabel imm;
 } BIns;
 
 typedef struct UIns {
-	UInsTableEntry *entry;
+	const UInsTableEntry *entry;
 	int rd;
 	NumOrLabel imm;	
 } UIns;
 
 typedef struct JIns {
-	JInsTableEntry *entry;
+	const JInsTableEntry *entry;
 	int rd;
 	NumOrLabel imm;
 } JIns;
@@ -93,11 +98,17 @@ typedef struct ParseNodeVec {
 	ParseNode *data;
 } ParseNodeVec;
 
+// The data segment. Bytes past `max` are counted in `len` but not
+// stored, since the program can't be loaded anyway; 0 means no limit.
+// A vector whose `cap` is already `max` never grows, so `data` can point
+// straight into the simulator's memory.
 typedef struct DataVec {
 	size_t len, cap;
 	uint8_t *data;
+	size_t max;
 } DataVec;
 
-void parser_init(Parser *p, Lexer *l);
+void parser_init(Parser *p, Lexer *l, Arena *arena);
 ParseNode parser_next(Parser *p, ParseErr *err);
+void parse_one(Parser *p, ParseNodeVec *pn, DataVec *d, ParseErr *err);
 void parse_all(Parser *p, ParseNodeVec *pn, DataVec *d, ParseErr *err);
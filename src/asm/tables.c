@@ -2,7 +2,7 @@
 #include "tables.h"
 #endif
 
-RegTableEntry reg_table[] = {
+const RegTableEntry reg_table[] = {
     {"zero", 0}, {"ra", 1}, {"sp", 2}, {"gp", 3},
     {"tp", 4}, {"t0", 5}, {"t1", 6}, {"t2", 7},
     {"s0", 8}, {"fp", 8}, {"s1", 9}, {"a0", 10}, {"a1", 11},
@@ -21,7 +21,7 @@ RegTableEntry reg_table[] = {
     {"x28", 28}, {"x29", 29}, {"x30", 30}, {"x31", 31}
 };
 
-RInsTableEntry r_ins_table[] = {
+const RInsTableEntry r_ins_table[] = {
     {"add", 0b0110011, 0x0, 0x00},
     {"sub", 0b0110011, 0x0, 0x20},
     {"sll", 0b0110011, 0x1, 0x00},
@@ -35,7 +35,7 @@ RInsTableEntry r_ins_table[] = {
 };
 
 
-IInsTableEntry i_ins_table[] = {
+const IInsTableEntry i_ins_table[] = {
     {"addi", 0b0010011, 0x0},
     {"andi", 0b0010011, 0x7},
     {"ori", 0b0010011, 0x6},
@@ -47,7 +47,7 @@ IInsTableEntry i_ins_table[] = {
     {"srai", 0b0010011, 0x5},
 };
 
-IInsTableEntry i_ins_table_2[] = {
+const IInsTableEntry i_ins_table_2[] = {
     {"lb", 0b0000011, 0x0},
     {"lh", 0b0000011, 0x1},
     {"lw", 0b0000011, 0x2},
@@ -58,14 +58,14 @@ IInsTableEntry i_ins_table_2[] = {
     {"jalr", 0b1100111, 0x0}
 };
 
-SInsTableEntry s_ins_table[] = {
+const SInsTableEntry s_ins_table[] = {
     {"sb", 0b0100011, 0x0},
     {"sh", 0b0100011, 0x1},
     {"sw", 0b0100011, 0x2},
     {"sd", 0b0100011, 0x3},
 };
 
-BInsTableEntry b_ins_table[] = {
+const BInsTableEntry b_ins_table[] = {
     {"beq",  0b1100011, 0x0},
     {"bne",  0b1100011, 0x1},
     {"blt",  0b1100011, 0x4},
@@ -74,11 +74,22 @@ BInsTableEntry b_ins_table[] = {
     {"bgeu", 0b1100011, 0x7},
 };
 
-UInsTableEntry u_ins_table[] = {
+const UInsTableEntry u_ins_table[] = {
     {"lui",  0b0110111},
     {"auipc", 0b0010111},
 };
 
-JInsTableEntry j_ins_table[] = {
+const JInsTableEntry j_ins_table[] = {
     {"jal", 0b1101111},
-};
\ No newline at end of file
+};
+
+// Number of entries in each table
+#define TABLE_LEN(t) (sizeof(t) / sizeof(t[0]))
+const int reg_table_len = TABLE_LEN(reg_table);
+const int r_ins_table_len = TABLE_LEN(r_ins_table);
+const int i_ins_table_len = TABLE_LEN(i_ins_table);
+const int i_ins_table_2_len = TABLE_LEN(i_ins_table_2);
+const int s_ins_table_len = TABLE_LEN(s_ins_table);
+const int b_ins_table_len = TABLE_LEN(b_ins_table);
+const int u_ins_table_len = TABLE_LEN(u_ins_table);
+const int j_ins_table_len = TABLE_LEN(j_ins_table);
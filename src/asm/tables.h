@@ -33,4 +33,16 @@ typedef struct UInsTableEntry {
 typedef struct JInsTableEntry {
     char *key;
     int opcode;
-} JInsTableEntry;
\ No newline at end of file
+} JInsTableEntry;
+
+extern const RegTableEntry reg_table[];
+extern const RInsTableEntry r_ins_table[];
+extern const IInsTableEntry i_ins_table[];
+extern const IInsTableEntry i_ins_table_2[];
+extern const SInsTableEntry s_ins_table[];
+extern const BInsTableEntry b_ins_table[];
+extern const UInsTableEntry u_ins_table[];
+extern const JInsTableEntry j_ins_table[];
+
+extern const int reg_table_len, r_ins_table_len, i_ins_table_len, i_ins_table_2_len,
+    s_ins_table_len, b_ins_table_len, u_ins_table_len, j_ins_table_len;
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifndef BATCH_H
+#include "batch.h"
+#endif
+
+#ifndef SIMULATOR_H
+#include "simulator.h"
+#endif
+
+#define JOB_CHUNK_SIZE 1024
+#define MANIFEST_LINE_SIZE 4096
+
+// A worker's queue of job indices. The owner takes jobs from the back,
+// idle workers steal from the front.
+typedef struct WorkQueue {
+    pthread_mutex_t lock;
+    size_t head, tail;
+    size_t *jobs;
+} WorkQueue;
+
+typedef struct BatchPool {
+    BatchJobVec *jobs;
+    WorkQueue *queues;
+    int num_threads;
+} BatchPool;
+
+typedef struct Worker {
+    pthread_t thread;
+    int id;
+    BatchPool *pool;
+} Worker;
+
+// Copies a manifest field, treating `-` as absent
+static char *manifest_field(char *tok) {
+    if (!tok || strcmp(tok, "-") == 0) return NULL;
+    return strdup(tok);
+}
+
+// Reads a manifest with one job per line: `<program> [config] [log]`.
+// A missing or `-` config runs without a cache, and a missing log
+// disables the cache log. Blank lines and lines starting with `#` are
+// skipped.
+int batch_load_manifest(BatchJobVec *jobs, char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        printf("Could not open manifest file\n");
+        return -1;
+    }
+
+    char line[MANIFEST_LINE_SIZE];
+    while (fgets(line, sizeof(line), f)) {
+        char *save;
+        char *program = strtok_r(line, " \t\r\n", &save);
+        if (!program || program[0] == '#') continue;
+        char *config = strtok_r(NULL, " \t\r\n", &save);
+        char *log = strtok_r(NULL, " \t\r\n", &save);
+
+        if (jobs->len == jobs->cap) {
+            jobs->data = realloc(jobs->data, (jobs->cap + JOB_CHUNK_SIZE) * sizeof(BatchJob));
+            jobs->cap += JOB_CHUNK_SIZE;
+        }
+
+        BatchJob job = {0};
+        job.program = strdup(program);
+        job.config = manifest_field(config);
+        job.log = manifest_field(log);
+        jobs->data[jobs->len++] = job;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+// Runs a single job on its own simulator
+static void batch_run_job(BatchJob *job) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    Simulator *s = calloc(1, sizeof(Simulator));
+    s->quiet = 1;
+    s->log_file = job->log;
+    s->log_disabled = !job->log;
+    s->seeded = job->seeded;
+    s->seed = job->seed;
+    s->asm_cache = job->asm_cache;
+    job->status = -1;
+
+    if (!job->config || load_cache_config(&s->cache_cfg, job->config) == 0) {
+        s->cache_enabled = (job->config != NULL);
+        sim_init(s);
+
+        if (sim_load(s, job->program) == 0) {
+            sim_run(s);
+            job->status = s->error? -1: 0; // Set by a trap that ended the program
+            job->instructions = s->retired;
+            if (s->cache_enabled) {
+                job->hits = s->cache->hits;
+                job->misses = s->cache->misses;
+                job->writebacks = s->cache->writebacks;
+            }
+        }
+    }
+
+    sim_uninit(s);
+    free(s);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    job->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// Takes a job from the back of the worker's own queue
+static int queue_pop(WorkQueue *q, size_t *job) {
+    int found = 0;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) {
+        *job = q->jobs[--q->tail];
+        found = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+// Steals a job from the front of another worker's queue
+static int queue_steal(WorkQueue *q, size_t *job) {
+    int found = 0;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) {
+        *job = q->jobs[q->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+// Runs jobs from the worker's queue, then steals from the others until
+// every queue is empty. No jobs are added once the workers start, so an
+// empty sweep means the batch is done.
+static void *batch_worker(void *arg) {
+    Worker *w = arg;
+    BatchPool *pool = w->pool;
+    size_t job;
+
+    while (1) {
+        if (queue_pop(&pool->queues[w->id], &job)) {
+            batch_run_job(&pool->jobs->data[job]);
+            continue;
+        }
+
+        int stolen = 0;
+        for (int i = 1; i < pool->num_threads && !stolen; i++) {
+            int victim = (w->id + i) % pool->num_threads;
+            stolen = queue_steal(&pool->queues[victim], &job);
+        }
+        if (!stolen) break;
+        batch_run_job(&pool->jobs->data[job]);
+    }
+    return NULL;
+}
+
+// Runs all jobs on a pool of `num_threads` workers
+void batch_run(BatchJobVec *jobs, int num_threads) {
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > jobs->len) num_threads = jobs->len;
+    if (num_threads == 0) return;
+
+    BatchPool pool = { jobs, calloc(num_threads, sizeof(WorkQueue)), num_threads };
+    Worker *workers = calloc(num_threads, sizeof(Worker));
+
+    // Deal the jobs out round-robin
+    for (int i = 0; i < num_threads; i++) {
+        WorkQueue *q = &pool.queues[i];
+        pthread_mutex_init(&q->lock, NULL);
+        q->jobs = malloc((jobs->len / num_threads + 1) * sizeof(size_t));
+    }
+    for (size_t i = 0; i < jobs->len; i++) {
+        WorkQueue *q = &pool.queues[i % num_threads];
+        q->jobs[q->tail++] = i;
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        workers[i].id = i;
+        workers[i].pool = &pool;
+        pthread_create(&workers[i].thread, NULL, batch_worker, &workers[i]);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        pthread_mutex_destroy(&pool.queues[i].lock);
+        free(pool.queues[i].jobs);
+    }
+    free(pool.queues);
+    free(workers);
+}
+
+// Prints one tab-separated row per job in manifest order, followed by
+// a row with the totals
+void batch_report(BatchJobVec *jobs, FILE *f) {
+    uint64_t instructions = 0;
+    size_t hits = 0, misses = 0, writebacks = 0, ok = 0;
+    double seconds = 0;
+
+    fprintf(f, "job\tprogram\tconfig\tstatus\tinstructions\taccesses\thits\tmisses\twritebacks\tseconds\n");
+    for (size_t i = 0; i < jobs->len; i++) {
+        BatchJob *j = &jobs->data[i];
+        fprintf(f, "%zu\t%s\t%s\t%s\t%lu\t%zu\t%zu\t%zu\t%zu\t%.6f\n", i, j->program,
+            j->config? j->config: "-", j->status? "error": "ok", j->instructions,
+            j->hits + j->misses, j->hits, j->misses, j->writebacks, j->seconds);
+
+        ok += !j->status;
+        instructions += j->instructions;
+        hits += j->hits;
+        misses += j->misses;
+        writebacks += j->writebacks;
+        seconds += j->seconds;
+    }
+    fprintf(f, "total\t-\t-\t%zu/%zu\t%lu\t%zu\t%zu\t%zu\t%zu\t%.6f\n",
+        ok, jobs->len, instructions, hits + misses, hits, misses, writebacks, seconds);
+}
@@ -0,0 +1,27 @@
+#define BATCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// One (program, cache config) pair from a batch manifest, along with
+// the results of running it
+typedef struct BatchJob {
+    char *program, *config, *log;
+    int seeded;    // Overrides the config's RANDOM seed with `seed`
+    uint64_t seed;
+    char *asm_cache; // Directory of cached program images, or NULL
+    int status; // 0 if the job ran to completion
+    uint64_t instructions;
+    size_t hits, misses, writebacks;
+    double seconds;
+} BatchJob;
+
+typedef struct BatchJobVec {
+    size_t len, cap;
+    BatchJob *data;
+} BatchJobVec;
+
+int batch_load_manifest(BatchJobVec *jobs, char *filename);
+void batch_run(BatchJobVec *jobs, int num_threads);
+void batch_report(BatchJobVec *jobs, FILE *f);
@@ -7,15 +7,30 @@
 #include <stdlib.h>
 #include <string.h>
 
-void load_cache_config(CacheConfig *cfg, char *filename) {
+// Loads a cache config file of the form
+//   <size> <block size> <associativity> <replacement> <write policy> [seed]
+// Returns 0 on success, -1 if the file can't
+// be read or describes an invalid cache.
+int load_cache_config(CacheConfig *cfg, char *filename) {
     FILE *f = fopen(filename, "r");
     if (f == NULL){
         printf("Unable to open the file. \n");
-        return;
+        return -1;
+    }
+    if (fscanf(f, "%lu %lu %lu", &cfg->size, &cfg->block_size, &cfg->associativity) != 3
+        || cfg->block_size == 0 || cfg->size < cfg->block_size * (cfg->associativity? cfg->associativity: 1)) {
+        printf("Invalid cache config. \n");
+        fclose(f);
+        return -1;
     }
-    fscanf(f, "%lu %lu %lu", &cfg->size, &cfg->block_size, &cfg->associativity);
     char replacement_policy[20] = {0}, writeback_policy[20] = {0};
-    fscanf(f, "%s %s", replacement_policy, writeback_policy);
+    fscanf(f, "%19s %19s", replacement_policy, writeback_policy);
+
+    // An optional seed for RANDOM replacement may follow the policies
+    if (fscanf(f, "%lu", &cfg->seed) != 1) {
+        cfg->seed = CACHE_DEFAULT_SEED;
+    }
+
     if (strcmp(replacement_policy, "RANDOM") == 0) {
         cfg->replacement_policy = RANDOM;
     } else if (strcmp(replacement_policy, "LRU") == 0) {
@@ -29,6 +44,27 @@ void load_cache_config(CacheConfig *cfg, char *filename) {
         cfg->writeback_policy = WRITETHROUGH;
     }
     fclose(f);
+    return 0;
+}
+
+// Seeds the replacement RNG. The seed is mixed with splitmix64 so that
+// small or zero seeds still give a well-distributed, non-zero state.
+void cache_seed(Cache *c, uint64_t seed) {
+    uint64_t z = seed + 0x9e3779b97f4a7c15;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    z = z ^ (z >> 31);
+    c->rand_state = z? z: 1;
+}
+
+// Returns the next number from the cache's xorshift64* generator
+static inline uint64_t cache_rand(Cache *c) {
+    uint64_t x = c->rand_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    c->rand_state = x;
+    return x * 0x2545f4914f6cdd1d;
 }
 
 // Initializes the cache (all the lines, blocks inside lines)
@@ -47,19 +83,66 @@ void cache_init(Cache *c, CacheConfig *cfg) {
     c->replacement_policy = cfg->replacement_policy;
     c->write_policy = cfg->writeback_policy;
 
+    c->hits = c->misses = c->writebacks = 0;
+    c->monotime = 0;
+    c->seed = cfg->seed;
+    cache_seed(c, cfg->seed);
+    c->output_file = NULL;
+    c->pc_counters = c->region_counters = NULL;
+    c->num_pcs = c->num_regions = 0;
+    c->unattributed_pc = c->unattributed_region = (CacheCounters){0};
+
     c->lines = malloc(c->num_lines * sizeof(CacheLine));
 
     for (int i = 0; i < c->num_lines; i++) { // go through each line, i.e, each set (a set corresponds to an index)
         c->lines[i].entries = malloc(c->associativity * sizeof(CacheEntry));
         for (int j = 0; j < c->associativity; j++) { // go through each block in the set
             c->lines[i].entries[j].valid = 0;
+            c->lines[i].entries[j].dirty = 0;
             c->lines[i].entries[j].data = malloc(c->block_size * sizeof(uint8_t));
         }
     }
 }
 
-// Selects a block to be replaced from the given line
-CacheEntry *cache_evict(Cache *c, CacheLine *line) {
+// Frees the lines and blocks of a cache
+void cache_free(Cache *c) {
+    for (int i = 0; i < c->num_lines; i++) {
+        for (int j = 0; j < c->associativity; j++) {
+            free(c->lines[i].entries[j].data);
+        }
+        free(c->lines[i].entries);
+    }
+    free(c->lines);
+    free(c->pc_counters);
+    free(c->region_counters);
+}
+
+// Allocates the per-instruction and per-region counters for a program
+// with `num_pcs` instructions running in `mem_size` bytes of memory
+void cache_attribute(Cache *c, size_t num_pcs, size_t mem_size) {
+    free(c->pc_counters);
+    free(c->region_counters);
+    c->num_pcs = num_pcs;
+    c->num_regions = (mem_size + CACHE_REGION_SIZE - 1) / CACHE_REGION_SIZE;
+    c->pc_counters = calloc(c->num_pcs, sizeof(CacheCounters));
+    c->region_counters = calloc(c->num_regions, sizeof(CacheCounters));
+}
+
+// Counters of the instruction at `pc`
+static inline CacheCounters *pc_counters(Cache *c, uint64_t pc) {
+    return (pc / 4 < c->num_pcs)? &c->pc_counters[pc / 4]: &c->unattributed_pc;
+}
+
+// Counters of the region containing `addr`
+static inline CacheCounters *region_counters(Cache *c, uint64_t addr) {
+    uint64_t region = addr / CACHE_REGION_SIZE;
+    return (region < c->num_regions)? &c->region_counters[region]: &c->unattributed_region;
+}
+
+// Selects a block to be replaced from the given line. A writeback is
+// counted against the instruction that caused it and the region of the
+// evicted block.
+CacheEntry *cache_evict(Cache *c, CacheLine *line, CacheCounters *pcc) {
     // If any entries are invalid, replace them
     for (int i = 0; i < c->associativity; i++) {
         if (!line->entries[i].valid) { // each block in a set has its own valid bit. 
@@ -71,7 +154,7 @@ CacheEntry *cache_evict(Cache *c, CacheLine *line) {
 
     // Replace a random entry
     if (c->replacement_policy == RANDOM) {
-        entry = &line->entries[rand() % c->associativity];
+        entry = &line->entries[(cache_rand(c) >> 32) % c->associativity];
     }
 
     // Replace first inserted (least insert-time) entry
@@ -97,14 +180,16 @@ CacheEntry *cache_evict(Cache *c, CacheLine *line) {
         c->writebacks += 1;
         uint64_t index = line - c->lines;
         uint64_t block_start = (entry->tag * c->num_lines * c->block_size) + (index * c->block_size);
+        pcc->writebacks++;
+        region_counters(c, block_start)->writebacks++;
         memcpy(&c->mem[block_start], entry->data, c->block_size);
     }
 
     return entry;
 }
 
-// Reads a certain number of bytes
-uint64_t cache_read(Cache *c, uint64_t addr, size_t num_bytes) {
+// Reads a certain number of bytes for the instruction at `pc`
+uint64_t cache_read(Cache *c, uint64_t pc, uint64_t addr, size_t num_bytes) {
     uint64_t offset = addr % c->block_size,
              index = (addr / c->block_size) % c->num_lines,
              tag = addr / (c->block_size * c->num_lines); // find the index, offset and tag of the address
@@ -122,6 +207,7 @@ uint64_t cache_read(Cache *c, uint64_t addr, size_t num_bytes) {
 
     CacheLine *line = &c->lines[index]; // Find the right index (right row/set) to look further into
     CacheEntry *entry;
+    CacheCounters *pcc = pc_counters(c, pc), *rc = region_counters(c, addr);
     int hit = 0;
 
     // Check if any of the entries in the line match
@@ -130,15 +216,19 @@ uint64_t cache_read(Cache *c, uint64_t addr, size_t num_bytes) {
             entry = &line->entries[i];
             hit = 1;
             c->hits++;
+            pcc->hits++;
+            rc->hits++;
             break;
         }        
     }
 
     if (!hit) {
         c->misses++;
+        pcc->misses++;
+        rc->misses++;
 
         // Load into cache
-        entry = cache_evict(c, line);
+        entry = cache_evict(c, line, pcc);
         uint64_t block_start = addr - (addr % (c->block_size));
         memcpy(entry->data, &c->mem[block_start], c->block_size * sizeof(uint8_t));
         entry->tag = tag;
@@ -151,9 +241,8 @@ uint64_t cache_read(Cache *c, uint64_t addr, size_t num_bytes) {
         }
     }
 
-    // Prints log
-    // TODO: Writes to a file
-    fprintf(c->output_file, "R: Address: 0x%lX, Set: 0x%lX, %s, Tag: 0x%lX, %s\n",
+    // Writes log
+    if (c->output_file) fprintf(c->output_file, "R: Address: 0x%lX, Set: 0x%lX, %s, Tag: 0x%lX, %s\n",
         addr, index, hit? "Hit": "Miss", tag, entry->dirty? "Dirty": "Clean");
 
     // Set access time
@@ -171,7 +260,8 @@ uint64_t cache_read(Cache *c, uint64_t addr, size_t num_bytes) {
     return result;
 }
 
-void cache_write(Cache *c, uint64_t addr, uint64_t value, size_t num_bytes) { 
+// Writes a certain number of bytes for the instruction at `pc`
+void cache_write(Cache *c, uint64_t pc, uint64_t addr, uint64_t value, size_t num_bytes) {
     uint64_t offset = addr % c->block_size,
              index = (addr / c->block_size) % c->num_lines,
              tag = addr / (c->block_size * c->num_lines);
@@ -182,7 +272,7 @@ void cache_write(Cache *c, uint64_t addr, uint64_t value, size_t num_bytes) {
         // between different blocks
         printf("WARN: Multi-block access; directly accessing memory.\n");
         for (int i = 0; i < num_bytes; i++) {
-            c->mem[addr + i] = value % 0xff;
+            c->mem[addr + i] = value & 0xff;
             value >>= 8;
         }
         return;
@@ -190,6 +280,7 @@ void cache_write(Cache *c, uint64_t addr, uint64_t value, size_t num_bytes) {
 
     CacheLine *line = &c->lines[index];
     CacheEntry *entry;
+    CacheCounters *pcc = pc_counters(c, pc), *rc = region_counters(c, addr);
     int hit = 0;
 
     // Check if any of the entries in the line match
@@ -198,28 +289,34 @@ void cache_write(Cache *c, uint64_t addr, uint64_t value, size_t num_bytes) {
             entry = &line->entries[i];
             hit = 1;
             c->hits++;
+            pcc->hits++;
+            rc->hits++;
             break;
         }        
     }
 
     if (!hit) {
         c->misses++;
+        pcc->misses++;
+        rc->misses++;
     
         // If writethrough, then assume no-allocate; and write directly to memory
         if (c->write_policy == WRITETHROUGH) {
             c->writebacks += 1;
+            pcc->writebacks++;
+            rc->writebacks++;
             for (int i = 0; i < num_bytes; i++) {
-                c->mem[addr + i] = value % 0xff; // taking the remainder when divided by 255
+                c->mem[addr + i] = value & 0xff;
                 value >>= 8;
             }
     
-            fprintf(c->output_file, "W: Address: 0x%lX, Set: 0x%lX, %s, Tag: 0x%lX, %s\n",
+            if (c->output_file) fprintf(c->output_file, "W: Address: 0x%lX, Set: 0x%lX, %s, Tag: 0x%lX, %s\n",
                 addr, index, "Miss", tag, "Clean");
             return; 
         }
 
         // Load into cache
-        entry = cache_evict(c, line); // evict some block in the line to make room for the new block we're writing to
+        entry = cache_evict(c, line, pcc); // evict some block in the line to make room for the new block we're writing to
         uint64_t block_start = addr - (addr % (c->block_size));
         memcpy(entry->data, &c->mem[block_start], c->block_size * sizeof(uint8_t));
         entry->tag = tag;
@@ -232,8 +329,8 @@ void cache_write(Cache *c, uint64_t addr, uint64_t value, size_t num_bytes) {
         }
     }
     
-    // Prints log
-    fprintf(c->output_file, "W: Address: 0x%lX, Set: 0x%lX, %s, Tag: 0x%lX, %s\n",
+    // Writes log
+    if (c->output_file) fprintf(c->output_file, "W: Address: 0x%lX, Set: 0x%lX, %s, Tag: 0x%lX, %s\n",
         addr, index, hit? "Hit": "Miss", tag, entry->dirty? "Dirty": "Clean");
 
     if (c->replacement_policy == LRU) {
@@ -243,15 +340,17 @@ void cache_write(Cache *c, uint64_t addr, uint64_t value, size_t num_bytes) {
     // In the case of write-through, write to memory and cache
     if (c->write_policy == WRITETHROUGH) {
         c->writebacks += 1;
+        pcc->writebacks++;
+        rc->writebacks++;
         for (int i = 0; i < num_bytes; i++) {
-            c->mem[addr + i] = value % 0xff;
+            c->mem[addr + i] = value & 0xff;
             value >>= 8;
         }
     } else {
         entry->dirty = 1;
     }
     for (int i = 0; i < num_bytes; i++) {
-        entry->data[offset + i] = value % 0xff;
+        entry->data[offset + i] = value & 0xff;
         value >>= 8;
     }
 
@@ -259,6 +358,42 @@ void cache_write(Cache *c, uint64_t addr, uint64_t value, size_t num_bytes) {
     return;
 }
 
+// Returns the cached copy of the byte at `addr`, or NULL if its block
+// isn't in the cache
+static uint8_t *cache_find(Cache *c, uint64_t addr) {
+    uint64_t index = (addr / c->block_size) % c->num_lines,
+             tag = addr / (c->block_size * c->num_lines);
+    CacheLine *line = &c->lines[index];
+    for (int i = 0; i < c->associativity; i++) {
+        if (line->entries[i].valid && line->entries[i].tag == tag) {
+            return &line->entries[i].data[addr % c->block_size];
+        }
+    }
+    return NULL;
+}
+
+// Reads bytes as the program would see them, without touching the
+// statistics, the log or the replacement state
+uint64_t cache_peek(Cache *c, uint64_t addr, size_t num_bytes) {
+    uint64_t result = 0;
+    for (int i = num_bytes - 1; i >= 0; i--) {
+        uint8_t *byte = cache_find(c, addr + i);
+        result = (result << 8) + (byte? *byte: c->mem[addr + i]);
+    }
+    return result;
+}
+
+// Writes bytes to memory and to any cached copies, without touching the
+// statistics, the log or the replacement state
+void cache_poke(Cache *c, uint64_t addr, uint64_t value, size_t num_bytes) {
+    for (int i = 0; i < num_bytes; i++) {
+        uint8_t *byte = cache_find(c, addr + i);
+        if (byte) *byte = value & 0xff;
+        c->mem[addr + i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
 void cache_invalidate(Cache *c) {
     for (int i = 0; i < c->num_lines; i++) {
         for (int j = 0; j < c->associativity; j++) {
@@ -268,6 +403,8 @@ void cache_invalidate(Cache *c) {
             if (entry->dirty) {
                 c->writebacks += 1;
                 uint64_t block_start = (entry->tag * c->num_lines * c->block_size) + (i * c->block_size);
+                c->unattributed_pc.writebacks++;
+                region_counters(c, block_start)->writebacks++;
                 memcpy(&c->mem[block_start], entry->data, c->block_size);
             }
 
@@ -300,6 +437,9 @@ void print_cache_config(Cache *c) {
         case FIFO: rp = "FIFO"; break;
     }
     printf("Replacement Policy: %s\n", rp);
+    if (c->replacement_policy == RANDOM) {
+        printf("Random Seed: %lu\n", c->seed);
+    }
 
     char *wp;
     switch (c->write_policy) {
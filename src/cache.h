@@ -4,10 +4,15 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+// Seed for RANDOM replacement when neither the config nor the command
+// line gives one
+#define CACHE_DEFAULT_SEED 1
+
 // Config struct for cache
 typedef struct CacheConfig {
     size_t size, block_size, associativity,
     writeback_policy, replacement_policy;
+    uint64_t seed;
 } CacheConfig;
 
 typedef struct CacheEntry {
@@ -17,6 +22,14 @@ typedef struct CacheEntry {
     uint8_t *data;
 } CacheEntry;
 
+// Accesses to memory are attributed to regions of this many bytes
+#define CACHE_REGION_SIZE 4096
+
+// Hit, miss and writeback counts for one instruction or memory region
+typedef struct CacheCounters {
+    size_t hits, misses, writebacks;
+} CacheCounters;
+
 typedef struct CacheLine {
     CacheEntry *entries;
 } CacheLine; 
@@ -29,21 +42,34 @@ typedef struct Cache {
     size_t num_lines, block_size, associativity;
     size_t hits, misses, writebacks;
     size_t monotime; // Monotonic counter used to simulate time
+    uint64_t seed, rand_state; // Per-cache RNG for RANDOM replacement
     enum {WRITEBACK, WRITETHROUGH} write_policy;
     enum {FIFO, LRU, RANDOM} replacement_policy;
 
     // Simulator memory
     uint8_t *mem;
     CacheLine *lines;
+
+    // Counters per issuing instruction (indexed by pc / 4) and per
+    // memory region. Events without a PC or outside every region go to
+    // `unattributed_pc` or `unattributed_region`, so both views add up
+    // to the totals.
+    CacheCounters *pc_counters, *region_counters, unattributed_pc, unattributed_region;
+    size_t num_pcs, num_regions;
     
     FILE *output_file;
 } Cache;
 
-void load_cache_config(CacheConfig *cfg, char *filename);
+int load_cache_config(CacheConfig *cfg, char *filename);
 void cache_init(Cache *c, CacheConfig *cfg);
+void cache_free(Cache *c);
+void cache_seed(Cache *c, uint64_t seed);
+void cache_attribute(Cache *c, size_t num_pcs, size_t mem_size);
 
-uint64_t cache_read(Cache *c, uint64_t addr, size_t num_bytes);
-void cache_write(Cache *c, uint64_t addr, uint64_t value, size_t num_bytes);
+uint64_t cache_read(Cache *c, uint64_t pc, uint64_t addr, size_t num_bytes);
+void cache_write(Cache *c, uint64_t pc, uint64_t addr, uint64_t value, size_t num_bytes);
+uint64_t cache_peek(Cache *c, uint64_t addr, size_t num_bytes);
+void cache_poke(Cache *c, uint64_t addr, uint64_t value, size_t num_bytes);
 
 void print_cache_config(Cache *c);
 void cache_invalidate(Cache *c);
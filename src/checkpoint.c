@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef CHECKPOINT_H
+#include "checkpoint.h"
+#endif
+
+#ifndef SIMULATOR_H
+#include "simulator.h"
+#endif
+
+/*
+   Checkpoints hold the architectural state of a running program (PC,
+   registers, memory and call stack) along with the contents and
+   statistics of the cache. Only non-zero pages of memory are stored.
+   The file is laid out as:
+
+     CheckpointHeader
+     CheckpointPage  x num_pages
+     CheckpointFrame x stack_len
+     CheckpointEntry x (cache lines * associativity)
+     blocks          x (cache lines * associativity), block_size bytes each
+
+   A checkpoint can only be loaded into the program it was taken from,
+   which is checked with a hash of the source.
+*/
+
+#define NUM_PAGES ((MEM_SIZE + CHECKPOINT_PAGE_SIZE - 1) / CHECKPOINT_PAGE_SIZE)
+
+// 64-bit FNV-1a hash of a NUL-terminated source
+uint64_t source_hash(const char *src) {
+    uint64_t h = 0xcbf29ce484222325;
+    for (; *src; src++) {
+        h = (h ^ (uint8_t)*src) * 0x100000001b3;
+    }
+    return h;
+}
+
+// Returns the number of bytes of memory in page `i`. The last page is
+// only partly used.
+static size_t page_len(size_t i) {
+    size_t start = i * CHECKPOINT_PAGE_SIZE;
+    return (MEM_SIZE - start < CHECKPOINT_PAGE_SIZE)? MEM_SIZE - start: CHECKPOINT_PAGE_SIZE;
+}
+
+static int page_is_zero(Simulator *s, size_t i) {
+    uint8_t *p = &s->mem[i * CHECKPOINT_PAGE_SIZE];
+    for (size_t j = 0; j < page_len(i); j++) {
+        if (p[j]) return 0;
+    }
+    return 1;
+}
+
+// Maps a stack entry's label to its index in `s->labels`
+static int32_t frame_label(Simulator *s, char *label) {
+    if (!label) return CHECKPOINT_NO_LABEL;
+    for (int i = 0; i < s->labels->len; i++) {
+        if (s->labels->data[i].lbl_name == label) return i;
+    }
+    return CHECKPOINT_MAIN;
+}
+
+// Writes the state of the simulator to a checkpoint file
+int checkpoint_save(Simulator *s, char *filename) {
+    if (!s->src) {
+        printf("No program loaded\n");
+        return -1;
+    }
+
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        printf("Could not open checkpoint file\n");
+        return -1;
+    }
+
+    CheckpointHeader h = {0};
+    memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+    h.src_hash = source_hash(s->src);
+    h.pc = s->pc;
+    memcpy(h.regs, s->regs, sizeof(h.regs));
+    h.retired = s->retired;
+    for (size_t i = 0; i < NUM_PAGES; i++) {
+        if (!page_is_zero(s, i)) h.num_pages++;
+    }
+    h.stack_len = s->stack->len;
+    h.pages_offset = sizeof(CheckpointHeader);
+    h.stack_offset = h.pages_offset + h.num_pages * sizeof(CheckpointPage);
+
+    Cache *c = s->cache;
+    size_t num_entries = 0;
+    if (s->cache_enabled && c) {
+        num_entries = c->num_lines * c->associativity;
+        h.cache_enabled = 1;
+        h.cache_size = c->num_lines * c->associativity * c->block_size;
+        h.block_size = c->block_size;
+        h.associativity = c->associativity;
+        h.write_policy = c->write_policy;
+        h.replacement_policy = c->replacement_policy;
+        h.seed = c->seed;
+        h.rand_state = c->rand_state;
+        h.monotime = c->monotime;
+        h.hits = c->hits;
+        h.misses = c->misses;
+        h.writebacks = c->writebacks;
+        h.entries_offset = h.stack_offset + h.stack_len * sizeof(CheckpointFrame);
+        h.blocks_offset = h.entries_offset + num_entries * sizeof(CheckpointEntry);
+    }
+    fwrite(&h, sizeof(h), 1, f);
+
+    // Pages are written in place as a CheckpointPage: the index, then the
+    // page, with the part of the last page past the end of memory zeroed
+    static const uint8_t zeros[CHECKPOINT_PAGE_SIZE];
+    for (size_t i = 0; i < NUM_PAGES; i++) {
+        if (page_is_zero(s, i)) continue;
+        uint64_t index = i;
+        fwrite(&index, sizeof(index), 1, f);
+        fwrite(&s->mem[i * CHECKPOINT_PAGE_SIZE], 1, page_len(i), f);
+        fwrite(zeros, 1, CHECKPOINT_PAGE_SIZE - page_len(i), f);
+    }
+
+    for (size_t i = 0; i < s->stack->len; i++) {
+        CheckpointFrame frame = { frame_label(s, s->stack->data[i].label), s->stack->data[i].line };
+        fwrite(&frame, sizeof(frame), 1, f);
+    }
+
+    for (size_t i = 0; i < num_entries; i++) {
+        CacheEntry *e = &c->lines[i / c->associativity].entries[i % c->associativity];
+        CheckpointEntry entry = { e->valid, e->dirty, e->tag, e->insert_time };
+        fwrite(&entry, sizeof(entry), 1, f);
+    }
+    for (size_t i = 0; i < num_entries; i++) {
+        fwrite(c->lines[i / c->associativity].entries[i % c->associativity].data, 1, c->block_size, f);
+    }
+
+    int status = (ferror(f) || fclose(f) != 0)? -1: 0;
+    if (status) printf("Could not write checkpoint file\n");
+    return status;
+}
+
+// Checks that the sections described by a header lie inside the file
+// and hold valid values
+static int checkpoint_valid(Simulator *s, const uint8_t *map, size_t len) {
+    const CheckpointHeader *h = (const CheckpointHeader*)map;
+    if (len < sizeof(CheckpointHeader) || memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic)) != 0) return 0;
+    if (h->num_pages > NUM_PAGES || h->pages_offset % 8 || h->stack_offset % 8) return 0;
+    if (h->pages_offset > len || h->num_pages * sizeof(CheckpointPage) > len - h->pages_offset) return 0;
+    if (h->stack_offset > len || h->stack_len > (len - h->stack_offset) / sizeof(CheckpointFrame)) return 0;
+    if (h->pc > MEM_SIZE - 4) return 0;
+
+    const CheckpointPage *pages = (const CheckpointPage*)(map + h->pages_offset);
+    for (size_t i = 0; i < h->num_pages; i++) {
+        if (pages[i].index >= NUM_PAGES) return 0;
+    }
+    const CheckpointFrame *frames = (const CheckpointFrame*)(map + h->stack_offset);
+    for (size_t i = 0; i < h->stack_len; i++) {
+        if (frames[i].label < CHECKPOINT_MAIN || frames[i].label >= s->labels->len) return 0;
+    }
+
+    if (!h->cache_enabled) return 1;
+    if (h->block_size == 0 || h->associativity == 0 || h->cache_size < h->block_size * h->associativity) return 0;
+    if (h->write_policy > WRITETHROUGH || h->replacement_policy > RANDOM) return 0;
+    size_t num_entries = h->cache_size / (h->block_size * h->associativity) * h->associativity;
+    if (h->entries_offset % 8 || h->entries_offset > len) return 0;
+    if (num_entries > (len - h->entries_offset) / sizeof(CheckpointEntry)) return 0;
+    if (h->blocks_offset > len || num_entries > (len - h->blocks_offset) / h->block_size) return 0;
+    return 1;
+}
+
+// Replaces the simulator's cache with a new one built from `cfg`,
+// keeping the cache log open
+static void replace_cache(Simulator *s, CacheConfig *cfg) {
+    FILE *log = NULL;
+    if (s->cache) {
+        log = s->cache->output_file;
+        cache_free(s->cache);
+    } else {
+        s->cache = malloc(sizeof(Cache));
+    }
+    cache_init(s->cache, cfg);
+    s->cache->mem = s->mem;
+    s->cache->output_file = log;
+    cache_attribute(s->cache, s->num_ins, MEM_SIZE);
+}
+
+// Restores a checkpoint taken from the loaded program. If the
+// checkpoint has no cache, the simulator's cache starts out empty.
+int checkpoint_load(Simulator *s, char *filename) {
+    if (!s->src) {
+        printf("No program loaded\n");
+        return -1;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Could not open checkpoint file\n");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        printf("Invalid checkpoint file\n");
+        close(fd);
+        return -1;
+    }
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Could not map checkpoint file\n");
+        return -1;
+    }
+
+    const CheckpointHeader *h = (const CheckpointHeader*)map;
+    if (!checkpoint_valid(s, map, st.st_size)) {
+        printf("Invalid checkpoint file\n");
+        munmap(map, st.st_size);
+        return -1;
+    }
+    if (h->src_hash != source_hash(s->src)) {
+        printf("Checkpoint was taken from a different program\n");
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    s->pc = h->pc;
+    memcpy(s->regs, h->regs, sizeof(s->regs));
+    s->retired = h->retired;
+
+    memset(s->mem, 0, MEM_SIZE);
+    const CheckpointPage *pages = (const CheckpointPage*)(map + h->pages_offset);
+    for (size_t i = 0; i < h->num_pages; i++) {
+        memcpy(&s->mem[pages[i].index * CHECKPOINT_PAGE_SIZE], pages[i].data, page_len(pages[i].index));
+    }
+
+    const CheckpointFrame *frames = (const CheckpointFrame*)(map + h->stack_offset);
+    s->stack->len = 0;
+    for (size_t i = 0; i < h->stack_len; i++) {
+        char *label = (frames[i].label >= 0)? s->labels->data[frames[i].label].lbl_name:
+            (frames[i].label == CHECKPOINT_MAIN)? "main": NULL;
+        sim_stack_push(s, label, frames[i].line);
+    }
+
+    if (h->cache_enabled) {
+        CacheConfig cfg = { h->cache_size, h->block_size, h->associativity,
+            h->write_policy, h->replacement_policy, h->seed };
+        s->cache_cfg = cfg;
+        s->cache_enabled = 1;
+        replace_cache(s, &cfg);
+
+        Cache *c = s->cache;
+        c->rand_state = h->rand_state;
+        c->monotime = h->monotime;
+        c->hits = h->hits;
+        c->misses = h->misses;
+        c->writebacks = h->writebacks;
+
+        const CheckpointEntry *entries = (const CheckpointEntry*)(map + h->entries_offset);
+        const uint8_t *blocks = map + h->blocks_offset;
+        for (size_t i = 0; i < c->num_lines * c->associativity; i++) {
+            CacheEntry *e = &c->lines[i / c->associativity].entries[i % c->associativity];
+            e->valid = entries[i].valid;
+            e->dirty = entries[i].dirty;
+            e->tag = entries[i].tag;
+            e->insert_time = entries[i].time;
+            memcpy(e->data, &blocks[i * c->block_size], c->block_size);
+        }
+    } else if (s->cache_enabled) {
+        replace_cache(s, &s->cache_cfg);
+    }
+    munmap(map, st.st_size);
+
+    // The text segment may have been overwritten since the program was
+    // loaded, and the new instructions may still be in the cache
+    sim_predecode(s);
+    sim_redecode(s, 0, s->text_end);
+    s->execution_in_progress = *(uint32_t*)(&s->mem[s->pc]) != 0;
+
+    // The undo log belongs to the timeline that was replaced
+    undo_reset(s);
+    return 0;
+}
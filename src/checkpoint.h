@@ -0,0 +1,51 @@
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct Simulator;
+
+#define CHECKPOINT_MAGIC "RVCKPT1"
+#define CHECKPOINT_PAGE_SIZE 4096
+
+// Fixed-size header at the start of a checkpoint file. The sections it
+// points to are stored at 8-byte aligned offsets, so a mapped file can
+// be read in place.
+typedef struct CheckpointHeader {
+    char magic[8];
+    uint64_t src_hash;       // Hash of the program the checkpoint was taken from
+    uint64_t pc, regs[32], retired;
+    uint64_t num_pages, stack_len;
+    uint64_t pages_offset, stack_offset;
+
+    // Cache geometry, policies and state; unused if `cache_enabled` is 0
+    uint64_t cache_enabled;
+    uint64_t cache_size, block_size, associativity, write_policy, replacement_policy;
+    uint64_t seed, rand_state, monotime, hits, misses, writebacks;
+    uint64_t entries_offset, blocks_offset;
+} CheckpointHeader;
+
+// A non-zero page of memory
+typedef struct CheckpointPage {
+    uint64_t index;
+    uint8_t data[CHECKPOINT_PAGE_SIZE];
+} CheckpointPage;
+
+// A call stack entry. `label` indexes `s->labels`, or is one of the
+// values below.
+typedef struct CheckpointFrame {
+    int32_t label, line;
+} CheckpointFrame;
+
+#define CHECKPOINT_NO_LABEL -1
+#define CHECKPOINT_MAIN -2
+
+// A cache entry, without its block. Blocks are stored separately in the
+// same order.
+typedef struct CheckpointEntry {
+    uint64_t valid, dirty, tag, time;
+} CheckpointEntry;
+
+uint64_t source_hash(const char *src);
+int checkpoint_save(struct Simulator *s, char *filename);
+int checkpoint_load(struct Simulator *s, char *filename);
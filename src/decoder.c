@@ -0,0 +1,489 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef SIMULATOR_H
+#include "simulator.h"
+#endif
+
+// Maximum number of pairs written by `fusion_dump`
+#define FUSION_MAX 16
+
+// Names of the operations, used when dumping the fusion table
+static const char *op_names[] = {
+#define X(name) #name,
+	OP_LIST(X)
+#undef X
+};
+
+/*
+   Operation bodies. These only compute the result of the instruction;
+   forcing x0 to zero and advancing the PC is done by the step and fused
+   handlers generated below.
+*/
+#define OP(name) static inline void op_##name(Simulator *s, DecodedIns *d)
+#define RS1 ((int64_t)s->regs[d->rs1])
+#define RS2 ((int64_t)s->regs[d->rs2])
+#define RD s->regs[d->rd]
+
+OP(NOP) {}
+
+// R format
+OP(ADD) { RD = (uint64_t)RS1 + (uint64_t)RS2; }
+OP(SUB) { RD = (uint64_t)RS1 - (uint64_t)RS2; }
+OP(XOR) { RD = RS1 ^ RS2; }
+OP(OR) { RD = RS1 | RS2; }
+OP(AND) { RD = RS1 & RS2; }
+OP(SLL) { RD = RS1 << (RS2 & 0x3f); }
+OP(SRL) { RD = (uint64_t)RS1 >> (RS2 & 0x3f); }
+OP(SRA) { RD = RS1 >> (RS2 & 0x3f); }
+OP(SLT) { RD = (RS1 < RS2)? 1: 0; }
+OP(SLTU) { RD = ((uint64_t)RS1 < (uint64_t)RS2)? 1: 0; }
+
+// I format arithmetic
+OP(ADDI) { RD = (uint64_t)RS1 + (int64_t)d->imm; }
+OP(XORI) { RD = RS1 ^ d->imm; }
+OP(ORI) { RD = RS1 | d->imm; }
+OP(ANDI) { RD = RS1 & d->imm; }
+OP(SLLI) { RD = RS1 << d->imm; }
+OP(SRLI) { RD = (uint64_t)RS1 >> d->imm; }
+OP(SRAI) { RD = RS1 >> d->imm; }
+OP(SLTI) { RD = (RS1 < d->imm)? 1: 0; }
+OP(SLTIU) { RD = ((uint64_t)RS1 < (uint64_t)(int64_t)d->imm)? 1: 0; }
+
+// I format loads
+OP(LB) { RD = (int8_t)mem_read(s, RS1 + d->imm, 1); }
+OP(LH) { RD = (int16_t)mem_read(s, RS1 + d->imm, 2); }
+OP(LW) { RD = (int32_t)mem_read(s, RS1 + d->imm, 4); }
+OP(LD) { RD = mem_read(s, RS1 + d->imm, 8); }
+OP(LBU) { RD = (uint8_t)mem_read(s, RS1 + d->imm, 1); }
+OP(LHU) { RD = (uint16_t)mem_read(s, RS1 + d->imm, 2); }
+OP(LWU) { RD = (uint32_t)mem_read(s, RS1 + d->imm, 4); }
+
+// S format stores. Stores into the text segment re-decode the
+// instructions they overwrite.
+#define STORE(n) { \
+	uint64_t addr = RS1 + d->imm; \
+	mem_write(s, addr, RS2, n); \
+	if (addr < s->text_end) sim_redecode(s, addr, n); \
+}
+OP(SB) STORE(1)
+OP(SH) STORE(2)
+OP(SW) STORE(4)
+OP(SD) STORE(8)
+
+// B format branches
+OP(BEQ) { if (RS1 == RS2) s->pc += d->imm - 4; }
+OP(BNE) { if (RS1 != RS2) s->pc += d->imm - 4; }
+OP(BLT) { if (RS1 < RS2) s->pc += d->imm - 4; }
+OP(BGE) { if (RS1 >= RS2) s->pc += d->imm - 4; }
+OP(BLTU) { if ((uint64_t)RS1 < (uint64_t)RS2) s->pc += d->imm - 4; }
+OP(BGEU) { if ((uint64_t)RS1 >= (uint64_t)RS2) s->pc += d->imm - 4; }
+
+// U and J format
+OP(LUI) { RD = (int64_t)d->imm; }
+OP(AUIPC) { RD = (int64_t)d->imm + s->pc; }
+OP(JAL) {
+	int64_t rd = s->pc + 4;
+	s->pc += d->imm - 4;
+	RD = rd;
+	if (!s->functional) sim_stack_push(s, (d->label >= 0)? s->labels->data[d->label].lbl_name: NULL, 0);
+}
+OP(JALR) {
+	int64_t rd = s->pc + 4;
+	s->pc = ((RS1 + d->imm) & ~1) - 4; // return address + immediate
+	RD = rd;
+	if (!s->functional) sim_stack_pop(s);
+}
+
+// 32-bit operations, whose results are sign-extended to 64 bits
+OP(ADDW) { RD = (int32_t)((uint32_t)RS1 + (uint32_t)RS2); }
+OP(SUBW) { RD = (int32_t)((uint32_t)RS1 - (uint32_t)RS2); }
+OP(SLLW) { RD = (int32_t)((uint32_t)RS1 << (RS2 & 0x1f)); }
+OP(SRLW) { RD = (int32_t)((uint32_t)RS1 >> (RS2 & 0x1f)); }
+OP(SRAW) { RD = (int32_t)RS1 >> (RS2 & 0x1f); }
+OP(ADDIW) { RD = (int32_t)((uint32_t)RS1 + (uint32_t)d->imm); }
+OP(SLLIW) { RD = (int32_t)((uint32_t)RS1 << d->imm); }
+OP(SRLIW) { RD = (int32_t)((uint32_t)RS1 >> d->imm); }
+OP(SRAIW) { RD = (int32_t)RS1 >> d->imm; }
+
+// System instructions raise a trap, which `sim_trap` handles once the
+// instruction has retired. There is no OS, so the only system call is
+// exit. Traps that end the program leave the PC on the instruction.
+OP(ECALL) {
+	if (s->regs[17] == SYS_EXIT || s->regs[17] == SYS_EXIT_GROUP) {
+		s->trap = TRAP_EXIT;
+	} else {
+		s->trap = TRAP_SYSCALL;
+		s->pc -= 4;
+	}
+}
+OP(EBREAK) { s->trap = TRAP_BREAK; }
+OP(ILLEGAL) {
+	s->trap = TRAP_ILLEGAL;
+	s->pc -= 4;
+}
+
+// Step handlers execute a single instruction
+#define X(name) \
+static void step_##name(Simulator *s, DecodedIns *d) { \
+	op_##name(s, d);                                    \
+	s->regs[0] = 0;                                     \
+	s->pc += 4;                                         \
+}
+OP_LIST(X)
+#undef X
+
+static const OpHandler step_handlers[] = {
+#define X(name) step_##name,
+	OP_LIST(X)
+#undef X
+};
+
+/*
+   Fused handlers execute two adjacent instructions in one dispatch.
+   The pairs are listed in fusion_table.h, which is generated from
+   profiled runs by `fusion dump`.
+*/
+#define FUSE(a, b)                                          \
+static void fused_##a##_##b(Simulator *s, DecodedIns *d) { \
+	op_##a(s, d);                                           \
+	s->regs[0] = 0;                                         \
+	s->pc += 4;                                             \
+	if (s->trap) return;                                    \
+	op_##b(s, d + 1);                                       \
+	s->regs[0] = 0;                                         \
+	s->pc += 4;                                             \
+}
+#include "fusion_table.h"
+#undef FUSE
+
+typedef struct FusionEntry {
+	uint8_t first, second;
+	OpHandler fn;
+} FusionEntry;
+
+static const FusionEntry fusion_table[] = {
+#define FUSE(a, b) { OP_##a, OP_##b, fused_##a##_##b },
+#include "fusion_table.h"
+#undef FUSE
+	{ OP_NOP, OP_NOP, NULL }
+};
+
+// Only instructions that fall through to the next one, can't rewrite
+// it and don't trap may start a fused pair
+static int fusable_first(int op) {
+	return !((op >= OP_SB && op <= OP_SD) || (op >= OP_BEQ && op <= OP_BGEU)
+		|| op == OP_JAL || op == OP_JALR || op >= OP_ECALL);
+}
+
+// Decodes a raw instruction into an operation and its operands.
+// Encodings outside RV64I decode to OP_ILLEGAL.
+void decode_ins(uint32_t ins, DecodedIns *d) {
+	int opcode = ins & 0b1111111,
+		funct3 = (ins >> 12) & 0b111,
+		funct7 = (ins >> 25) & 0b1111111;
+
+	d->raw = ins;
+	d->op = OP_ILLEGAL;
+	d->rd = (ins >> 7) & 0b11111;
+	d->rs1 = (ins >> 15) & 0b11111;
+	d->rs2 = (ins >> 20) & 0b11111;
+	d->imm = 0;
+	d->label = -1;
+	d->fused = 0;
+
+	switch (opcode) {
+	case 0b0110011: // R format
+		if (funct7 == 0x20) {
+			if (funct3 == 0x0) d->op = OP_SUB;
+			else if (funct3 == 0x5) d->op = OP_SRA;
+			break;
+		}
+		if (funct7 != 0x00) break;
+
+		switch (funct3) {
+		case 0x0: d->op = OP_ADD; break;
+		case 0x4: d->op = OP_XOR; break;
+		case 0x6: d->op = OP_OR; break;
+		case 0x7: d->op = OP_AND; break;
+		case 0x1: d->op = OP_SLL; break;
+		case 0x5: d->op = OP_SRL; break;
+		case 0x2: d->op = OP_SLT; break;
+		case 0x3: d->op = OP_SLTU; break;
+		}
+		break;
+
+	case 0b0111011: // R format, 32-bit
+		if (funct7 == 0x20) {
+			if (funct3 == 0x0) d->op = OP_SUBW;
+			else if (funct3 == 0x5) d->op = OP_SRAW;
+			break;
+		}
+		if (funct7 != 0x00) break;
+
+		switch (funct3) {
+		case 0x0: d->op = OP_ADDW; break;
+		case 0x1: d->op = OP_SLLW; break;
+		case 0x5: d->op = OP_SRLW; break;
+		}
+		break;
+
+	case 0b0010011: { // I format arithmetic
+		int imm = ins >> 20;
+		imm = imm | (0xfffff000 * (imm >> 11));
+		d->imm = imm;
+
+		switch (funct3) {
+		case 0x0: d->op = OP_ADDI; break;
+		case 0x4: d->op = OP_XORI; break;
+		case 0x6: d->op = OP_ORI; break;
+		case 0x7: d->op = OP_ANDI; break;
+		case 0x1:
+			d->imm = imm & 0b111111;
+			if ((imm >> 6) == 0x00) d->op = OP_SLLI;
+			break;
+		case 0x5:
+			d->imm = imm & 0b111111;
+			if ((imm >> 6) == 0x10) d->op = OP_SRAI;
+			else if ((imm >> 6) == 0x00) d->op = OP_SRLI;
+			break;
+		case 0x2: d->op = OP_SLTI; break;
+		case 0x3: d->op = OP_SLTIU; break;
+		}
+		break;
+	}
+
+	case 0b0011011: { // I format arithmetic, 32-bit
+		int imm = ins >> 20;
+		imm = imm | (0xfffff000 * (imm >> 11));
+		d->imm = imm;
+
+		switch (funct3) {
+		case 0x0: d->op = OP_ADDIW; break;
+		case 0x1:
+			d->imm = imm & 0b11111;
+			if (funct7 == 0x00) d->op = OP_SLLIW;
+			break;
+		case 0x5:
+			d->imm = imm & 0b11111;
+			if (funct7 == 0x20) d->op = OP_SRAIW;
+			else if (funct7 == 0x00) d->op = OP_SRLIW;
+			break;
+		}
+		break;
+	}
+
+	case 0b0000011: { // I format loads
+		int imm = ins >> 20;
+		imm = imm | (0xfffff000 * (imm >> 11));
+		d->imm = imm;
+
+		switch (funct3) {
+		case 0x0: d->op = OP_LB; break;
+		case 0x1: d->op = OP_LH; break;
+		case 0x2: d->op = OP_LW; break;
+		case 0x3: d->op = OP_LD; break;
+		case 0x4: d->op = OP_LBU; break;
+		case 0x5: d->op = OP_LHU; break;
+		case 0x6: d->op = OP_LWU; break;
+		}
+		break;
+	}
+
+	case 0b0100011: { // S format stores
+		int imm = ((ins >> 7) & 0b11111) + ((ins >> 25) << 5);
+		imm = imm | (0xfffff000 * (imm >> 11));
+		d->imm = imm;
+
+		switch (funct3) {
+		case 0x0: d->op = OP_SB; break;
+		case 0x1: d->op = OP_SH; break;
+		case 0x2: d->op = OP_SW; break;
+		case 0x3: d->op = OP_SD; break;
+		}
+		break;
+	}
+
+	case 0b1100011: { // B format branches
+		int imm = ((ins >> 31) << 11) + // 12
+			(((ins >> 7) & 0b1) << 10) + // 11
+			(((ins >> 25) & 0b111111) << 4) + // 10:5
+			((ins >> 8) & 0b1111); // 4:1
+		imm = imm << 1;
+		imm = imm | (0xffffe000 * (imm >> 12)); // sign extension to 32 bits
+		d->imm = imm;
+
+		switch (funct3) {
+		case 0x0: d->op = OP_BEQ; break;
+		case 0x1: d->op = OP_BNE; break;
+		case 0x4: d->op = OP_BLT; break;
+		case 0x5: d->op = OP_BGE; break;
+		case 0x6: d->op = OP_BLTU; break;
+		case 0x7: d->op = OP_BGEU; break;
+		}
+		break;
+	}
+
+	case 0b0110111: // lui
+		d->op = OP_LUI;
+		d->imm = (int32_t)(ins & 0xfffff000);
+		break;
+
+	case 0b0010111: // auipc
+		d->op = OP_AUIPC;
+		d->imm = (int32_t)(ins & 0xfffff000);
+		break;
+
+	case 0b1101111: { // jal
+		int imm = ((ins >> 31) << 19) + // 20
+			(((ins >> 12) & 0b11111111) << 11) + // 19:12
+			(((ins >> 20) & 0b1) << 10) + // 11
+			((ins >> 21) & 0b1111111111); // 10:1
+		imm = imm << 1;
+		imm = imm | 0xffe00000 * (imm >> 20); // sign extension
+		d->op = OP_JAL;
+		d->imm = imm;
+		break;
+	}
+
+	case 0b1100111: { // jalr
+		int imm = ins >> 20;
+		imm = imm | (0xfffff000 * (imm >> 11));
+		d->imm = imm;
+		if (funct3 == 0x0) d->op = OP_JALR;
+		break;
+	}
+
+	case 0b0001111: // fence and fence.i, which have nothing to order
+		d->op = OP_NOP;
+		break;
+
+	case 0b1110011: // ecall and ebreak. There are no CSRs.
+		if (ins == 0x00000073) d->op = OP_ECALL;
+		else if (ins == 0x00100073) d->op = OP_EBREAK;
+		break;
+	}
+
+	d->fn = step_handlers[d->op];
+}
+
+// Executes a single decoded instruction, ignoring any fusion
+void exec_ins(Simulator *s, DecodedIns *d) {
+	step_handlers[d->op](s, d);
+}
+
+// Decodes the instruction at index `i` of the text segment from `ins`.
+// Jump targets of `jal` are resolved to labels here so the call stack
+// doesn't have to search for them at run time.
+static void predecode_at(Simulator *s, size_t i, uint32_t ins) {
+	DecodedIns *d = &s->decoded[i];
+	decode_ins(ins, d);
+
+	if (d->op == OP_JAL) {
+		uint64_t target = 4 * i + d->imm;
+		for (int j = 0; j < s->labels->len; j++) {
+			if (s->labels->data[j].offset == target) {
+				d->label = j;
+			}
+		}
+	}
+}
+
+// Decodes every instruction of the text segment
+void sim_predecode(Simulator *s) {
+	for (size_t i = 0; i < s->num_ins; i++) {
+		predecode_at(s, i, *(uint32_t*)(&s->mem[4 * i]));
+	}
+
+	sim_fuse(s);
+}
+
+// Selects the handler of the instruction at index `i`: a fused handler
+// if it and the next instruction are a pair in the fusion table, or its
+// step handler. A pair is not fused if its second instruction has a
+// breakpoint, so execution can always stop there. Fusion is disabled
+// while profiling, so that every pair is counted and every access has
+// its own PC, while recording the undo log and while there are
+// watchpoints.
+static void fuse_at(Simulator *s, size_t i) {
+	DecodedIns *d = &s->decoded[i];
+	d->fn = step_handlers[d->op];
+	d->fused = 0;
+
+	if (s->pair_counts || s->profile || s->undo || s->watches->len || i + 1 >= s->num_ins) return;
+	if (!fusable_first(d->op) || s->bp_at[i + 1]) return;
+
+	for (const FusionEntry *e = fusion_table; e->fn; e++) {
+		if (e->first == d->op && e->second == d[1].op) {
+			d->fn = e->fn;
+			d->fused = 1;
+			return;
+		}
+	}
+}
+
+// Selects the handlers of the whole text segment, see `fuse_at`
+void sim_fuse(Simulator *s) {
+	for (size_t i = 0; i < s->num_ins; i++) fuse_at(s, i);
+}
+
+// Re-decodes the instructions overlapped by `len` bytes written at
+// `addr`, and re-fuses the pairs they are part of. The instructions are
+// read as the program sees them, so bytes still in a dirty cache line
+// count.
+void sim_redecode(Simulator *s, uint64_t addr, size_t len) {
+	if (!len || addr >= s->text_end) return;
+	size_t first = addr / 4, last = (addr + len - 1) / 4;
+	if (last >= s->num_ins) last = s->num_ins - 1;
+
+	for (size_t i = first; i <= last; i++) {
+		predecode_at(s, i, mem_peek(s, 4 * i, 4));
+	}
+	for (size_t i = first? first - 1: 0; i <= last; i++) {
+		fuse_at(s, i);
+	}
+}
+
+// Counts the pair starting at an executed instruction
+void fusion_count(Simulator *s, DecodedIns *d) {
+	size_t i = d - s->decoded;
+	if (i + 1 >= s->num_ins || !fusable_first(d->op)) return;
+	s->pair_counts[d->op * NUM_OPS + d[1].op]++;
+}
+
+// Writes the most frequently executed pairs as a fusion table
+int fusion_dump(Simulator *s, char *filename) {
+	if (!s->pair_counts) {
+		printf("Fusion profiling is not enabled\n");
+		return -1;
+	}
+
+	FILE *f = fopen(filename, "w");
+	if (!f) {
+		printf("Could not open output file\n");
+		return -1;
+	}
+
+	fprintf(f, "// Generated by `fusion dump` from profiled runs. Each entry\n");
+	fprintf(f, "// fuses two adjacent instructions into a single handler.\n");
+
+	// Repeatedly pick the pair with the highest count
+	uint64_t *counts = malloc(NUM_OPS * NUM_OPS * sizeof(uint64_t));
+	memcpy(counts, s->pair_counts, NUM_OPS * NUM_OPS * sizeof(uint64_t));
+	for (int n = 0; n < FUSION_MAX; n++) {
+		int best = 0;
+		for (int i = 1; i < NUM_OPS * NUM_OPS; i++) {
+			if (counts[i] > counts[best]) best = i;
+		}
+		if (!counts[best]) break;
+
+		fprintf(f, "FUSE(%s, %s) // %lu\n", op_names[best / NUM_OPS],
+			op_names[best % NUM_OPS], counts[best]);
+		counts[best] = 0;
+	}
+
+	free(counts);
+	fclose(f);
+	return 0;
+}
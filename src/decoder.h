@@ -0,0 +1,51 @@
+#define DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct Simulator;
+struct DecodedIns;
+
+// A handler executes one decoded instruction (or a fused pair) and
+// advances the PC past it
+typedef void (*OpHandler)(struct Simulator *s, struct DecodedIns *d);
+
+// All operations understood by the interpreter
+#define OP_LIST(X) \
+	X(NOP) \
+	X(ADD) X(SUB) X(XOR) X(OR) X(AND) X(SLL) X(SRL) X(SRA) X(SLT) X(SLTU) \
+	X(ADDI) X(XORI) X(ORI) X(ANDI) X(SLLI) X(SRLI) X(SRAI) X(SLTI) X(SLTIU) \
+	X(LB) X(LH) X(LW) X(LD) X(LBU) X(LHU) X(LWU) \
+	X(SB) X(SH) X(SW) X(SD) \
+	X(BEQ) X(BNE) X(BLT) X(BGE) X(BLTU) X(BGEU) \
+	X(LUI) X(AUIPC) X(JAL) X(JALR) \
+	X(ADDW) X(SUBW) X(SLLW) X(SRLW) X(SRAW) \
+	X(ADDIW) X(SLLIW) X(SRLIW) X(SRAIW) \
+	X(ECALL) X(EBREAK) X(ILLEGAL)
+
+typedef enum Op {
+#define X(name) OP_##name,
+	OP_LIST(X)
+#undef X
+	NUM_OPS
+} Op;
+
+// An instruction decoded once at load time. `fn` is the handler used by
+// `sim_run`; it executes both this and the next instruction when the
+// pair has been fused.
+typedef struct DecodedIns {
+	OpHandler fn;
+	uint32_t raw;
+	int32_t imm;
+	int32_t label; // Index of the jump target in `s->labels` (JAL only)
+	uint8_t op, rd, rs1, rs2;
+	uint8_t fused;
+} DecodedIns;
+
+void decode_ins(uint32_t ins, DecodedIns *d);
+void exec_ins(struct Simulator *s, DecodedIns *d);
+void sim_predecode(struct Simulator *s);
+void sim_redecode(struct Simulator *s, uint64_t addr, size_t len);
+void sim_fuse(struct Simulator *s);
+void fusion_count(struct Simulator *s, DecodedIns *d);
+int fusion_dump(struct Simulator *s, char *filename);
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+
+#ifndef ELF_LOADER_H
+#include "elf_loader.h"
+#endif
+
+#ifndef SIMULATOR_H
+#include "simulator.h"
+#endif
+
+/*
+   Loader for statically linked RV64I executables. The PT_LOAD segments
+   are copied to their virtual addresses, so all of them have to fit in
+   guest memory, and the text segment runs from address 0 to the end of
+   the last executable segment. Function symbols become labels, which
+   names calls in the call stack and the profile.
+
+   There is no source, so a listing with one line per instruction stands
+   in for it: the nearest label, the offset from it and the encoding.
+   Line n is the instruction at address 4 * (n - 1), which is what
+   breakpoints refer to.
+*/
+
+#ifndef EF_RISCV_RVC
+#define EF_RISCV_RVC 0x0001
+#endif
+
+// The stack starts at the top of memory
+#define ELF_STACK_TOP ((MEM_SIZE - 1) & ~(uint64_t)15)
+
+// Returns 1 if `buf` starts with the ELF magic number
+int elf_detect(const char *buf, size_t len) {
+    return len >= SELFMAG && memcmp(buf, ELFMAG, SELFMAG) == 0;
+}
+
+// Leaves `msg` in `s->error` and fails the load
+static int elf_error(Simulator *s, const char *msg) {
+    s->error = strdup(msg);
+    return -1;
+}
+
+// Orders labels by offset, then by name
+static int label_cmp(const void *a, const void *b) {
+    const LabelEntry *x = a, *y = b;
+    if (x->offset != y->offset) return (x->offset < y->offset)? -1: 1;
+    return strcmp(x->lbl_name, y->lbl_name);
+}
+
+// Imports the function symbols that lie in the text segment as labels,
+// sorted by offset
+static void elf_import_symbols(Simulator *s, const uint8_t *buf, size_t len) {
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr*)buf;
+    if (!eh->e_shoff || eh->e_shentsize != sizeof(Elf64_Shdr) || eh->e_shoff > len ||
+        eh->e_shnum > (len - eh->e_shoff) / sizeof(Elf64_Shdr)) return;
+    const Elf64_Shdr *sh = (const Elf64_Shdr*)(buf + eh->e_shoff);
+
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) continue;
+        const Elf64_Shdr *strtab = &sh[sh[i].sh_link];
+        if (sh[i].sh_offset > len || sh[i].sh_size > len - sh[i].sh_offset) continue;
+        if (strtab->sh_offset > len || strtab->sh_size > len - strtab->sh_offset) continue;
+
+        const Elf64_Sym *syms = (const Elf64_Sym*)(buf + sh[i].sh_offset);
+        const char *names = (const char*)(buf + strtab->sh_offset);
+        size_t num_syms = sh[i].sh_size / sizeof(Elf64_Sym);
+        s->labels->data = arena_alloc(&s->arena, num_syms * sizeof(LabelEntry));
+        s->labels->cap = num_syms;
+
+        for (size_t j = 0; j < num_syms; j++) {
+            const Elf64_Sym *sym = &syms[j];
+            int type = ELF64_ST_TYPE(sym->st_info);
+            if (type != STT_FUNC && type != STT_NOTYPE) continue;
+            if (sym->st_shndx == SHN_UNDEF || sym->st_value >= s->text_end || sym->st_value % 4) continue;
+            if (sym->st_name >= strtab->sh_size) continue;
+
+            // Mapping symbols (`$x`) and local labels aren't useful names
+            const char *name = &names[sym->st_name];
+            size_t n = strnlen(name, strtab->sh_size - sym->st_name);
+            if (n == 0 || n == strtab->sh_size - sym->st_name || name[0] == '$' || strncmp(name, ".L", 2) == 0) continue;
+
+            LabelEntry *l = &s->labels->data[s->labels->len++];
+            l->lbl_name = arena_strndup(&s->arena, name, n);
+            l->offset = sym->st_value;
+        }
+        qsort(s->labels->data, s->labels->len, sizeof(LabelEntry), label_cmp);
+        return;
+    }
+}
+
+// Builds the listing that serves as the program's source
+static void elf_listing(Simulator *s) {
+    size_t len;
+    FILE *f = open_memstream(&s->src, &len);
+    LabelEntry *label = NULL;
+    for (size_t i = 0, j = 0; i < s->num_ins; i++) {
+        uint64_t pc = 4 * i;
+        while (j < s->labels->len && s->labels->data[j].offset <= pc) label = &s->labels->data[j++];
+
+        uint32_t ins = *(uint32_t*)(&s->mem[pc]);
+        if (label) {
+            fprintf(f, "%s+0x%lx (0x%08x)\n", label->lbl_name, pc - label->offset, ins);
+        } else {
+            fprintf(f, "0x%08lx (0x%08x)\n", pc, ins);
+        }
+    }
+    fclose(f);
+    s->src_len = len;
+    s->src_mapped = 0;
+
+    s->ins_lines = malloc(s->num_ins * sizeof(int));
+    for (size_t i = 0; i < s->num_ins; i++) s->ins_lines[i] = i + 1;
+}
+
+// Loads a statically linked RV64I executable of `len` bytes into a
+// freshly initialized simulator. The caller keeps the buffer. On failure
+// the error message is left in `s->error`, memory is untouched and a
+// non-zero value is returned.
+int elf_load(Simulator *s, const uint8_t *buf, size_t len) {
+    free(s->error);
+    s->error = NULL;
+
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr*)buf;
+    if (len < sizeof(Elf64_Ehdr) || !elf_detect((const char*)buf, len) || eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+        eh->e_ident[EI_DATA] != ELFDATA2LSB || eh->e_machine != EM_RISCV) {
+        return elf_error(s, "Error: Not a 64-bit RISC-V ELF file\n");
+    }
+    if (eh->e_type != ET_EXEC) {
+        return elf_error(s, "Error: Only statically linked executables can be loaded\n");
+    }
+    if (eh->e_flags & EF_RISCV_RVC) {
+        return elf_error(s, "Error: Compressed instructions are not supported\n");
+    }
+    if (eh->e_phentsize != sizeof(Elf64_Phdr) || eh->e_phoff > len ||
+        eh->e_phnum > (len - eh->e_phoff) / sizeof(Elf64_Phdr)) {
+        return elf_error(s, "Error: Corrupt ELF file\n");
+    }
+
+    // Check every segment before copying any of them
+    const Elf64_Phdr *ph = (const Elf64_Phdr*)(buf + eh->e_phoff);
+    uint64_t text_end = 0;
+    for (int i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type == PT_INTERP || ph[i].p_type == PT_DYNAMIC) {
+            return elf_error(s, "Error: Only statically linked executables can be loaded\n");
+        }
+        if (ph[i].p_type != PT_LOAD) continue;
+        if (ph[i].p_filesz > ph[i].p_memsz || ph[i].p_offset > len || ph[i].p_filesz > len - ph[i].p_offset) {
+            return elf_error(s, "Error: Corrupt ELF file\n");
+        }
+        if (ph[i].p_vaddr > MEM_SIZE - 1 || ph[i].p_memsz > MEM_SIZE - 1 - ph[i].p_vaddr) {
+            return elf_error(s, "Error: Program does not fit in memory\n");
+        }
+        if ((ph[i].p_flags & PF_X) && ph[i].p_vaddr + ph[i].p_memsz > text_end) {
+            text_end = ph[i].p_vaddr + ph[i].p_memsz;
+        }
+    }
+    text_end = (text_end + 3) & ~(uint64_t)3;
+    if (text_end > MEM_SIZE - 1) {
+        return elf_error(s, "Error: Program does not fit in memory\n");
+    }
+    if (eh->e_entry % 4 || eh->e_entry >= text_end) {
+        return elf_error(s, "Error: Entry point is outside the text segment\n");
+    }
+
+    // Memory is already zeroed, which covers the tail of each segment
+    // past its file contents
+    for (int i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type == PT_LOAD) memcpy(&s->mem[ph[i].p_vaddr], buf + ph[i].p_offset, ph[i].p_filesz);
+    }
+    s->elf = 1;
+    s->text_end = text_end;
+    s->num_ins = text_end / 4;
+    s->pc = eh->e_entry;
+    s->regs[2] = ELF_STACK_TOP;
+
+    elf_import_symbols(s, buf, len);
+    elf_listing(s);
+    sim_load_finish(s);
+    return 0;
+}
@@ -0,0 +1,9 @@
+#define ELF_LOADER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct Simulator;
+
+int elf_detect(const char *buf, size_t len);
+int elf_load(struct Simulator *s, const uint8_t *buf, size_t len);
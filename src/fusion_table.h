@@ -0,0 +1,13 @@
+// Generated by `fusion dump` from profiled runs. Each entry
+// fuses two adjacent instructions into a single handler.
+FUSE(ADDI, BEQ) // 1016
+FUSE(SLLI, ADD) // 488
+FUSE(ADDI, ADDI) // 456
+FUSE(ADD, ADDI) // 448
+FUSE(LD, ADDI) // 328
+FUSE(LD, SLLI) // 128
+FUSE(ADD, BEQ) // 48
+FUSE(ADDI, SLLI) // 40
+FUSE(ADDI, ADD) // 8
+FUSE(LD, LD) // 8
+FUSE(LUI, LD) // 8
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef IMAGE_H
+#include "image.h"
+#endif
+
+#ifndef SIMULATOR_H
+#include "simulator.h"
+#endif
+
+/*
+   A program image is an assembled program: the text and data segments,
+   the labels, the source line of each instruction and the source
+   itself. `asm -o` writes one and `loadimg` loads it without running
+   the assembler. Images also serve as the assembler cache. When `s->asm_cache` names a directory,
+   `sim_load` looks there for an image of the source, keyed by its hash
+   and the assembler version. It only runs the assembler when no image
+   exists, and then stores one for the next load.
+*/
+
+// Rounds a section length up to the next 8-byte boundary
+#define ALIGN8(n) (((n) + 7) & ~(uint64_t)7)
+
+// Pads a section of `len` bytes to an 8-byte boundary
+static void write_padding(FILE *f, size_t len) {
+    static const uint8_t zeros[8];
+    fwrite(zeros, 1, ALIGN8(len) - len, f);
+}
+
+// Writes a section and its padding
+static void write_section(FILE *f, const void *data, size_t len) {
+    fwrite(data, 1, len, f);
+    write_padding(f, len);
+}
+
+// Writes the loaded program as an image
+static int image_write(Simulator *s, FILE *f, uint64_t src_hash) {
+    ImageHeader h = {0};
+    memcpy(h.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    h.asm_version = ASM_VERSION;
+    h.src_hash = src_hash;
+    h.entry = 0;
+    h.text_len = 4 * s->num_ins;
+    h.src_len = s->src_len;
+    h.data_len = s->data_len;
+    h.num_labels = s->labels->len;
+    for (int i = 0; i < s->labels->len; i++) {
+        h.names_len += strlen(s->labels->data[i].lbl_name) + 1;
+    }
+
+    h.text_offset = sizeof(ImageHeader);
+    h.data_offset = h.text_offset + ALIGN8(h.text_len);
+    h.labels_offset = h.data_offset + ALIGN8(h.data_len);
+    h.lines_offset = h.labels_offset + ALIGN8(h.num_labels * sizeof(ImageLabel));
+    h.names_offset = h.lines_offset + ALIGN8(s->num_ins * sizeof(int32_t));
+    h.src_offset = h.names_offset + ALIGN8(h.names_len);
+    fwrite(&h, sizeof(h), 1, f);
+
+    write_section(f, s->mem, h.text_len);
+    write_section(f, &s->mem[DATA_SEGMENT_START], h.data_len);
+
+    uint32_t name = 0;
+    for (int i = 0; i < s->labels->len; i++) {
+        ImageLabel label = { s->labels->data[i].offset, name };
+        fwrite(&label, sizeof(label), 1, f);
+        name += strlen(s->labels->data[i].lbl_name) + 1;
+    }
+    write_padding(f, h.num_labels * sizeof(ImageLabel));
+
+    write_section(f, s->ins_lines, s->num_ins * sizeof(int32_t));
+    for (int i = 0; i < s->labels->len; i++) {
+        fwrite(s->labels->data[i].lbl_name, 1, strlen(s->labels->data[i].lbl_name) + 1, f);
+    }
+    write_padding(f, h.names_len);
+    fwrite(s->src, 1, h.src_len, f);
+    return ferror(f)? -1: 0;
+}
+
+// Writes the loaded program to an image file
+int image_save(Simulator *s, char *filename, uint64_t src_hash) {
+    if (!s->decoded) {
+        printf("No program loaded\n");
+        return -1;
+    }
+    if (s->elf) {
+        printf("ELF executables can't be written to images\n");
+        return -1;
+    }
+
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        printf("Could not open image file\n");
+        return -1;
+    }
+    int status = image_write(s, f, src_hash);
+    if (fclose(f) != 0) status = -1;
+    if (status) printf("Could not write image file\n");
+    return status;
+}
+
+// Checks that every section of a mapped image lies within the file and
+// fits in memory, and that the sections are consistent with each other
+static int image_valid(const uint8_t *map, size_t size) {
+    const ImageHeader *h = (const ImageHeader*)map;
+    if (size < sizeof(ImageHeader) || memcmp(h->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0) return 0;
+    if (h->asm_version != ASM_VERSION) return 0;
+    if (h->text_len % 4 || h->text_len > DATA_SEGMENT_START) return 0;
+    if (h->data_len > MEM_SIZE - DATA_SEGMENT_START) return 0;
+    if (h->entry % 4 || h->entry > h->text_len) return 0;
+    if (h->num_labels > size / sizeof(ImageLabel) || h->names_len > size) return 0;
+
+    uint64_t sections[][2] = {
+        { h->text_offset, h->text_len },
+        { h->data_offset, h->data_len },
+        { h->labels_offset, h->num_labels * sizeof(ImageLabel) },
+        { h->lines_offset, h->text_len / 4 * sizeof(int32_t) },
+        { h->names_offset, h->names_len },
+        { h->src_offset, h->src_len },
+    };
+    for (size_t i = 0; i < sizeof(sections) / sizeof(sections[0]); i++) {
+        if (sections[i][0] % 8 || sections[i][0] > size || sections[i][1] > size - sections[i][0]) return 0;
+    }
+
+    // Names have to be NUL-terminated and labels have to point into the
+    // text segment
+    const char *names = (const char*)(map + h->names_offset);
+    if (h->names_len && names[h->names_len - 1] != '\0') return 0;
+    const ImageLabel *labels = (const ImageLabel*)(map + h->labels_offset);
+    for (size_t i = 0; i < h->num_labels; i++) {
+        if (labels[i].name >= h->names_len || labels[i].offset > h->text_len) return 0;
+    }
+
+    // The source is loaded with a NUL after it, which has to be its only
+    // one, and every instruction's line has to be in it, or `print_line`
+    // would run past its end
+    const char *src = (const char*)(map + h->src_offset);
+    if (memchr(src, '\0', h->src_len)) return 0;
+    int64_t num_lines = 1;
+    for (const char *p = src; (p = memchr(p, '\n', src + h->src_len - p)); p++) num_lines++;
+    const int32_t *lines = (const int32_t*)(map + h->lines_offset);
+    for (size_t i = 0; i < h->text_len / 4; i++) {
+        if (lines[i] < 1 || lines[i] > num_lines) return 0;
+    }
+    return 1;
+}
+
+// Maps an image and loads its program into a freshly initialized
+// simulator. A non-zero `src_hash` has to match the image's, and the
+// caller then provides the source; otherwise the image's copy of the
+// source is loaded. Returns -1 if the file can't be read and -2 if it
+// is not a valid image of the source; the simulator is unchanged in
+// both cases.
+int image_load(Simulator *s, char *filename, uint64_t src_hash) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -2;
+    }
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const ImageHeader *h = (const ImageHeader*)map;
+    if (!image_valid(map, st.st_size) || (src_hash && h->src_hash != src_hash)) {
+        munmap(map, st.st_size);
+        return -2;
+    }
+
+    memcpy(s->mem, map + h->text_offset, h->text_len);
+    memcpy(&s->mem[DATA_SEGMENT_START], map + h->data_offset, h->data_len);
+    s->num_ins = h->text_len / 4;
+    s->data_len = h->data_len;
+    s->pc = h->entry;
+
+    const ImageLabel *labels = (const ImageLabel*)(map + h->labels_offset);
+    const char *names = (const char*)(map + h->names_offset);
+    s->labels->data = arena_alloc(&s->arena, h->num_labels * sizeof(LabelEntry));
+    s->labels->len = s->labels->cap = h->num_labels;
+    for (size_t i = 0; i < h->num_labels; i++) {
+        const char *name = &names[labels[i].name];
+        s->labels->data[i].lbl_name = arena_strndup(&s->arena, name, strlen(name));
+        s->labels->data[i].offset = labels[i].offset;
+    }
+
+    s->ins_lines = malloc(s->num_ins * sizeof(int));
+    memcpy(s->ins_lines, map + h->lines_offset, s->num_ins * sizeof(int32_t));
+    if (!src_hash) {
+        s->src = malloc(h->src_len + 1);
+        memcpy(s->src, map + h->src_offset, h->src_len);
+        s->src[h->src_len] = '\0';
+        s->src_len = h->src_len;
+        s->src_mapped = 0;
+    }
+    munmap(map, st.st_size);
+
+    sim_load_finish(s);
+    return 0;
+}
+
+// Returns the path of the cached image of a source, which the caller
+// frees
+char *image_cache_path(char *dir, uint64_t src_hash) {
+    size_t n = strlen(dir) + 32;
+    char *path = malloc(n);
+    snprintf(path, n, "%s/%016lx-v%d.img", dir, src_hash, ASM_VERSION);
+    return path;
+}
+
+// Stores the loaded program in the cache. The image is written to a
+// temporary file and renamed into place, so concurrent loads never see
+// a partial image.
+int image_cache_store(Simulator *s, char *dir, uint64_t src_hash) {
+    mkdir(dir, 0777);
+    char *path = image_cache_path(dir, src_hash);
+    size_t n = strlen(path) + 8;
+    char *tmp = malloc(n);
+    snprintf(tmp, n, "%s.XXXXXX", path);
+
+    int status = -1;
+    int fd = mkstemp(tmp);
+    FILE *f = (fd >= 0)? fdopen(fd, "wb"): NULL;
+    if (f) {
+        status = image_write(s, f, src_hash);
+        if (fclose(f) != 0) status = -1;
+        if (status == 0) status = rename(tmp, path);
+        if (status) unlink(tmp);
+    } else if (fd >= 0) {
+        close(fd);
+        unlink(tmp);
+    }
+
+    free(tmp);
+    free(path);
+    return status;
+}
@@ -0,0 +1,36 @@
+#define IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct Simulator;
+
+#define IMAGE_MAGIC "RVIMG2"
+
+// Bumped whenever the assembler's output changes, which invalidates
+// cached images
+#define ASM_VERSION 1
+
+// Fixed-size header at the start of a program image. The sections it
+// points to are stored at 8-byte aligned offsets, so a mapped file can
+// be read in place. The source is kept so that an image loaded on its
+// own can still print source lines and be checkpointed.
+typedef struct ImageHeader {
+    char magic[8];
+    uint64_t asm_version;
+    uint64_t src_hash;       // Hash of the source the image was assembled from
+    uint64_t entry;          // PC of the first instruction to run
+    uint64_t text_len, data_len, num_labels, names_len, src_len;
+    uint64_t text_offset, data_offset, labels_offset, lines_offset, names_offset, src_offset;
+} ImageHeader;
+
+// A label's offset in the text segment and the position of its
+// NUL-terminated name in the names section
+typedef struct ImageLabel {
+    uint32_t offset, name;
+} ImageLabel;
+
+int image_save(struct Simulator *s, char *filename, uint64_t src_hash);
+int image_load(struct Simulator *s, char *filename, uint64_t src_hash);
+char *image_cache_path(char *dir, uint64_t src_hash);
+int image_cache_store(struct Simulator *s, char *dir, uint64_t src_hash);
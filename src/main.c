@@ -1,7 +1,8 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
-#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
 
 #ifndef CACHE_H
 #include "cache.h"
@@ -11,66 +12,127 @@
 #include "simulator.h"
 #endif
 
-int main(void) {
-    srand(time(NULL));
+#ifndef TRACE_H
+#include "trace.h"
+#endif
+
+#ifndef CHECKPOINT_H
+#include "checkpoint.h"
+#endif
+
+#ifndef SAMPLE_H
+#include "sample.h"
+#endif
+
+#ifndef SIMPOINT_H
+#include "simpoint.h"
+#endif
 
-    Simulator s = {0};
-    sim_init(&s);
+#ifndef BATCH_H
+#include "batch.h"
+#endif
+
+#define USAGE \
+    "Usage: riscv_sim [options]\n" \
+    "  -c, --cache <config>   Enable the cache simulator with a config file\n" \
+    "  -r, --run <program>    Load and run a program without the prompt\n" \
+    "  -f, --script <file>    Read commands from a file instead of stdin\n" \
+    "  -A, --asm <program>    Assemble a program into an image without running it\n" \
+    "  -o, --output <image>   Image written by --asm, the program's name with\n" \
+    "                         `.s` replaced by `.img` by default\n" \
+    "  -s, --stats            Print statistics after running\n" \
+    "  -q, --quiet            Don't print each executed instruction\n" \
+    "  -t, --trace <file>     Record the memory accesses of --run to a trace\n" \
+    "  -m, --sample <spec>    Run --run in sampled mode, spec is skip,warmup,window[,period]\n" \
+    "  -p, --profile          Print a per-instruction profile after running\n" \
+    "  -1, --one-pass         Assemble in a single pass with label backpatching\n" \
+    "  -a, --asm-cache <dir>  Cache assembled programs in a directory\n" \
+    "  -S, --seed <n>         Seed for RANDOM cache replacement\n" \
+    "  -b, --batch <manifest> Run every job in a manifest and print a report\n" \
+    "  -j, --jobs <n>         Number of threads for batch mode and for assembling\n" \
+    "                         large sources\n" \
+    "  -h, --help             Show this message\n"
 
+// Reads and executes commands until `exit` or end of input
+void run_commands(Simulator *s, FILE *in) {
     while (1) {
         char input[100] = "\0";
-        scanf("%s", input);
+        if (fscanf(in, "%99s", input) != 1) break;
+
         if (strcmp(input, "cache_sim") == 0) {
-            scanf("%s", input);  // Read the next word (enable/disable/status/invalidate/dump/stats)
+            fscanf(in, "%99s", input);  // Read the next word (enable/disable/status/invalidate/dump/stats)
             if (strcmp(input, "enable") == 0) {
                 char config_file[100] = "\0";
-                scanf("%s", config_file);    
+                fscanf(in, "%99s", config_file);
 
-                if (s.execution_in_progress) {
+                if (s->execution_in_progress) {
                     printf("Can't enable cache during execution.\n");
                     continue;
                 }
 
-                s.cache_enabled = 1;
-                load_cache_config(&s.cache_cfg, config_file);
-                sim_init(&s);
-            } 
+                if (load_cache_config(&s->cache_cfg, config_file) != 0) continue;
+                s->cache_enabled = 1;
+                sim_init(s);
+            }
             else if (strcmp(input, "disable") == 0) {
-                if (s.execution_in_progress) {
+                if (s->execution_in_progress) {
                     printf("Can't disable cache during execution.\n");
                     continue;
                 }
 
-                s.cache_enabled = 0;
+                s->cache_enabled = 0;
                 printf("Cache simulator disabled.\n");
-            } 
+            }
             else if (strcmp(input, "status") == 0) {
-                printf("%s\n", s.cache_enabled ? "Cache enabled." : "Cache disabled.");
-                if (s.cache_enabled) {
-                    print_cache_config(s.cache);
+                printf("%s\n", s->cache_enabled ? "Cache enabled." : "Cache disabled.");
+                if (s->cache_enabled) {
+                    print_cache_config(s->cache);
                 }
             }
             else if (strcmp(input, "invalidate") == 0){
-                if (s.cache_enabled) {
-                    cache_invalidate(s.cache);
+                if (s->cache_enabled) {
+                    cache_invalidate(s->cache);
                 } else {
                     printf("Cache is disabled\n");
                 }
             }
             else if (strcmp(input, "dump") == 0){ // only take care of the valid entries
                 char dump_file[100] = "\0";
-                scanf("%s", dump_file);
+                fscanf(in, "%99s", dump_file);
 
-                if (s.cache_enabled) {
+                if (s->cache_enabled) {
                     printf("\n");
-                    cache_dump(s.cache, dump_file);
+                    cache_dump(s->cache, dump_file);
                 } else {
                     printf("Cache is disabled\n");
                 }
             }
+            else if (strcmp(input, "replay") == 0) {
+                // cache_sim replay <trace> <config> [log|-] [threads]
+                char line[300] = "\0", trace_file[100] = "\0", config_file[100] = "\0", log_file[100] = "\0";
+                int threads = sysconf(_SC_NPROCESSORS_ONLN);
+                fgets(line, sizeof(line), in);
+                if (sscanf(line, "%99s %99s %99s %d", trace_file, config_file, log_file, &threads) < 2) {
+                    printf("Usage: cache_sim replay <trace> <config> [log|-] [threads]\n");
+                    continue;
+                }
+                int logging = log_file[0] && strcmp(log_file, "-") != 0;
+
+                CacheConfig cfg;
+                CacheCounters totals;
+                if (load_cache_config(&cfg, config_file) != 0) continue;
+                if (s->seeded) cfg.seed = s->seed;
+                trace_replay(trace_file, &cfg, logging? log_file: NULL, threads, &totals);
+            }
             else if (strcmp(input, "stats") == 0){
-                if (s.cache_enabled) {
-                    print_cache_stats(s.cache);
+                // `--by-pc` may follow on the same line
+                char options[100] = "\0";
+                fgets(options, sizeof(options), in);
+
+                if (s->cache_enabled && strstr(options, "--by-pc")) {
+                    sim_cache_stats_by_pc(s);
+                } else if (s->cache_enabled) {
+                    print_cache_stats(s->cache);
                 } else {
                     printf("Cache is disabled\n");
                 }
@@ -79,38 +141,277 @@ int main(void) {
 
         else if (strcmp(input, "load") == 0) {
             char filename[100] = "\0";
-            scanf("%s", filename);
-            sim_init(&s);
-            sim_load(&s, filename); 
+            fscanf(in, "%99s", filename);
+            sim_init(s);
+            sim_load(s, filename);
+        } else if (strcmp(input, "loadimg") == 0) {
+            char filename[100] = "\0";
+            fscanf(in, "%99s", filename);
+            sim_init(s);
+            sim_load_image(s, filename);
+        } else if (strcmp(input, "asm") == 0) {
+            // asm <program> -o <image>
+            char line[300] = "\0", filename[100] = "\0", option[100] = "\0", image_file[100] = "\0";
+            fgets(line, sizeof(line), in);
+            if (sscanf(line, "%99s %99s %99s", filename, option, image_file) != 3 || strcmp(option, "-o") != 0) {
+                printf("Usage: asm <program> -o <image>\n");
+                continue;
+            }
+            sim_init(s);
+            if (sim_load(s, filename) == 0 && image_save(s, image_file, source_hash(s->src)) == 0) {
+                printf("Image written to %s\n", image_file);
+            }
         } else if (strcmp(input, "run") == 0) {
-            sim_run(&s);
+            // `--trace <file>` may follow on the same line
+            char line[200] = "\0", option[100] = "\0", trace_file[100] = "\0";
+            fgets(line, sizeof(line), in);
+            if (sscanf(line, "%99s %99s", option, trace_file) == 2 && strcmp(option, "--trace") == 0) {
+                sim_run_traced(s, trace_file);
+            } else {
+                sim_run(s);
+            }
         } else if (strcmp(input, "regs") == 0) {
-            sim_regs(&s);
+            sim_regs(s);
         } else if (strcmp(input, "mem") == 0) {
             int start, count;
-            scanf(" %x %d", &start, &count);
-            sim_mem(&s, start, count);
+            fscanf(in, " %x %d", &start, &count);
+            sim_mem(s, start, count);
         } else if (strcmp(input, "step") == 0) {
-            sim_step(&s);
+            sim_step(s);
         } else if (strcmp(input, "break") == 0) {
             int line;
-            scanf(" %d", &line);
-            sim_add_breakpoint(&s, line);
+            fscanf(in, " %d", &line);
+            sim_add_breakpoint(s, line);
+        } else if (strcmp(input, "watch") == 0) {
+            // watch <addr> [len] [r|w|rw]
+            char line[200] = "\0", mode[100] = "w";
+            uint64_t addr, len = 8;
+            fgets(line, sizeof(line), in);
+            if (sscanf(line, "%lx %lu %99s", &addr, &len, mode) < 1) {
+                printf("Usage: watch <addr> [len] [r|w|rw]\n");
+            } else {
+                int m = (strchr(mode, 'r')? WATCH_READ: 0) | (strchr(mode, 'w')? WATCH_WRITE: 0);
+                sim_add_watch(s, addr, len, m? m: WATCH_WRITE);
+            }
         } else if (strcmp(input, "del") == 0) {
-            scanf("%s", input);;
-            if (strcmp(input, "break") != 0) continue; 
-            int line;
-            scanf(" %d", &line);
-            sim_remove_breakpoint(&s, line);
+            fscanf(in, "%99s", input);
+            if (strcmp(input, "break") == 0) {
+                int line;
+                fscanf(in, " %d", &line);
+                sim_remove_breakpoint(s, line);
+            } else if (strcmp(input, "watch") == 0) {
+                uint64_t addr;
+                fscanf(in, " %lx", &addr);
+                sim_remove_watch(s, addr);
+            }
+        } else if (strcmp(input, "fusion") == 0) {
+            fscanf(in, "%99s", input);
+            if (strcmp(input, "profile") == 0) {
+                // Count executed pairs; fusion stays off while profiling
+                if (!s->pair_counts) {
+                    s->pair_counts = calloc(NUM_OPS * NUM_OPS, sizeof(uint64_t));
+                }
+                if (s->decoded) sim_fuse(s);
+                printf("Fusion profiling enabled\n");
+            } else if (strcmp(input, "dump") == 0) {
+                char table_file[100] = "\0";
+                fscanf(in, "%99s", table_file);
+                if (fusion_dump(s, table_file) == 0) {
+                    printf("Fusion table written to %s\n", table_file);
+                }
+            }
+        } else if (strcmp(input, "undo") == 0) {
+            // undo on [entries] | undo off
+            char line[200] = "\0", option[100] = "\0";
+            size_t entries = UNDO_DEFAULT_ENTRIES;
+            fgets(line, sizeof(line), in);
+            sscanf(line, "%99s %zu", option, &entries);
+            if (strcmp(option, "on") == 0 && entries > 0) {
+                undo_enable(s, entries);
+                printf("Recording the last %zu instructions\n", entries);
+            } else if (strcmp(option, "off") == 0) {
+                undo_disable(s);
+                printf("Reverse execution disabled\n");
+            }
+        } else if (strcmp(input, "reverse-step") == 0) {
+            sim_reverse_step(s);
+        } else if (strcmp(input, "reverse-continue") == 0) {
+            sim_reverse_continue(s);
+        } else if (strcmp(input, "sample") == 0) {
+            char spec[100] = "\0";
+            fscanf(in, "%99s", spec);  // skip,warmup,window[,period]
+            SampleConfig cfg;
+            if (sample_parse(&cfg, spec) == 0) sim_sample(s, &cfg);
+        } else if (strcmp(input, "simpoint") == 0) {
+            // simpoint <interval> <clusters> [bbv file]
+            char line[200] = "\0", bbv_file[100] = "\0";
+            uint64_t interval = 0;
+            int k = 0;
+            fgets(line, sizeof(line), in);
+            if (sscanf(line, "%lu %d %99s", &interval, &k, bbv_file) < 2) {
+                printf("Usage: simpoint <interval> <clusters> [bbv file]\n");
+            } else {
+                sim_simpoints(s, interval, k, bbv_file[0]? bbv_file: NULL);
+            }
+        } else if (strcmp(input, "checkpoint") == 0) {
+            char checkpoint_file[100] = "\0";
+            fscanf(in, "%99s %99s", input, checkpoint_file);  // save/load <file>
+            if (strcmp(input, "save") == 0) {
+                if (checkpoint_save(s, checkpoint_file) == 0) {
+                    printf("Checkpoint written to %s\n", checkpoint_file);
+                }
+            } else if (strcmp(input, "load") == 0) {
+                if (checkpoint_load(s, checkpoint_file) == 0) {
+                    printf("Checkpoint loaded from %s\n", checkpoint_file);
+                }
+            }
+        } else if (strcmp(input, "profile") == 0) {
+            fscanf(in, "%99s", input);  // on/off/report
+            if (strcmp(input, "on") == 0) {
+                profile_enable(s);
+                printf("Profiling enabled\n");
+            } else if (strcmp(input, "off") == 0) {
+                profile_disable(s);
+                printf("Profiling disabled\n");
+            } else if (strcmp(input, "report") == 0) {
+                profile_report(s);
+            }
+        } else if (strcmp(input, "stats") == 0) {
+            sim_stats(s);
         } else if (strcmp(input, "show-stack") == 0) {
-            sim_show_stack(&s);
+            sim_show_stack(s);
         } else if (strcmp(input, "exit") == 0) {
             printf("Exited the simulator\n");
             break;
         }
         printf("\n");
     }
+}
+
+int main(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"cache",  required_argument, 0, 'c'},
+        {"run",    required_argument, 0, 'r'},
+        {"script", required_argument, 0, 'f'},
+        {"asm",    required_argument, 0, 'A'},
+        {"output", required_argument, 0, 'o'},
+        {"stats",  no_argument,       0, 's'},
+        {"quiet",  no_argument,       0, 'q'},
+        {"trace",  required_argument, 0, 't'},
+        {"sample", required_argument, 0, 'm'},
+        {"profile", no_argument,      0, 'p'},
+        {"one-pass", no_argument,     0, '1'},
+        {"asm-cache", required_argument, 0, 'a'},
+        {"seed",   required_argument, 0, 'S'},
+        {"batch",  required_argument, 0, 'b'},
+        {"jobs",   required_argument, 0, 'j'},
+        {"help",   no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    char *cache_file = NULL, *asm_cache = NULL, *asm_program = NULL, *image_file = NULL, *program = NULL, *script = NULL, *manifest = NULL, *trace_file = NULL, *sample = NULL;
+    int stats = 0, quiet = 0, profiling = 0, one_pass = 0, seeded = 0, jobs = sysconf(_SC_NPROCESSORS_ONLN), opt;
+    uint64_t seed = 0;
+    while ((opt = getopt_long(argc, argv, "c:r:f:A:o:sqt:m:p1a:S:b:j:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c': cache_file = optarg; break;
+            case 'r': program = optarg; break;
+            case 'f': script = optarg; break;
+            case 'A': asm_program = optarg; break;
+            case 'o': image_file = optarg; break;
+            case 's': stats = 1; break;
+            case 'q': quiet = 1; break;
+            case 't': trace_file = optarg; break;
+            case 'm': sample = optarg; break;
+            case 'p': profiling = 1; break;
+            case '1': one_pass = 1; break;
+            case 'a': asm_cache = optarg; break;
+            case 'S': seed = strtoull(optarg, NULL, 0); seeded = 1; break;
+            case 'b': manifest = optarg; break;
+            case 'j': jobs = atoi(optarg); break;
+            case 'h': printf(USAGE); return 0;
+            default: fprintf(stderr, USAGE); return 2;
+        }
+    }
+
+    // Batch mode runs each job on its own simulator
+    if (manifest) {
+        BatchJobVec batch = {0};
+        if (batch_load_manifest(&batch, manifest) != 0) return 1;
+        for (size_t i = 0; i < batch.len; i++) {
+            batch.data[i].seeded = seeded;
+            batch.data[i].seed = seed;
+            batch.data[i].asm_cache = asm_cache;
+        }
+        batch_run(&batch, jobs);
+        batch_report(&batch, stdout);
+
+        for (size_t i = 0; i < batch.len; i++) {
+            if (batch.data[i].status) return 1;
+        }
+        return 0;
+    }
+
+    Simulator *s = calloc(1, sizeof(Simulator));
+    s->quiet = quiet;
+    s->profiling = profiling;
+    s->one_pass = one_pass;
+    s->asm_threads = jobs;
+    s->asm_cache = asm_cache;
+    s->seeded = seeded;
+    s->seed = seed;
+
+    if (cache_file) {
+        if (load_cache_config(&s->cache_cfg, cache_file) != 0) return 1;
+        s->cache_enabled = 1;
+    }
+    sim_init(s);
+
+    int status = 0;
+    if (asm_program) {
+        // The image goes next to the program unless --output names it
+        char *image = image_file;
+        if (!image) {
+            size_t n = strlen(asm_program);
+            if (n >= 2 && strcmp(&asm_program[n - 2], ".s") == 0) n -= 2;
+            image = malloc(n + sizeof(".img"));
+            sprintf(image, "%.*s.img", (int)n, asm_program);
+        }
+        if (sim_load(s, asm_program) != 0 || image_save(s, image, source_hash(s->src)) != 0) status = 1;
+        if (image != image_file) free(image);
+        sim_uninit(s);
+        return status;
+    }
+
+    if (program) {
+        if (sim_load(s, program) != 0) {
+            status = 1;
+        } else if (sample) {
+            SampleConfig cfg;
+            if (sample_parse(&cfg, sample) != 0 || sim_sample(s, &cfg) != 0) status = 1;
+        } else if (trace_file) {
+            if (sim_run_traced(s, trace_file) != 0) status = 1;
+        } else {
+            sim_run(s);
+        }
+        if (s->error) status = 1; // Set by a trap that ended the program
+    }
+
+    if (script) {
+        FILE *f = fopen(script, "r");
+        if (!f) {
+            fprintf(stderr, "Could not open script file\n");
+            status = 1;
+        } else {
+            run_commands(s, f);
+            fclose(f);
+        }
+    } else if (!program) {
+        run_commands(s, stdin);
+    }
+
+    if (stats && !status) sim_stats(s);
 
-    sim_uninit(&s);
-    return 0;
-}
\ No newline at end of file
+    sim_uninit(s);
+    return status;
+}
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef SIMULATOR_H
+#include "simulator.h"
+#endif
+
+// Number of instructions listed in the hot-spot report
+#define PROFILE_TOP 10
+
+/*
+   Per-instruction profiler. Counters are kept in a dense array with one
+   entry per instruction of the text segment, indexed by `pc / 4`, so
+   each event is a single increment. Instructions aren't fused while
+   profiling, so the PC of every access belongs to the instruction that
+   made it.
+*/
+
+// Allocates the counters for the loaded program. Profiling stays on
+// across loads until it is disabled.
+void profile_enable(Simulator *s) {
+	s->profiling = 1;
+	if (!s->profile && s->num_ins) {
+		s->profile = calloc(s->num_ins, sizeof(ProfileEntry));
+	}
+	if (s->decoded) sim_fuse(s);
+}
+
+void profile_disable(Simulator *s) {
+	s->profiling = 0;
+	free(s->profile);
+	s->profile = NULL;
+	if (s->decoded) sim_fuse(s);
+}
+
+// Counts an executed instruction. `s->pc` has already moved past it, so
+// a conditional branch was taken if it doesn't point at the next one.
+void profile_retire(Simulator *s, uint64_t pc) {
+	if (pc >= s->text_end) return;
+	ProfileEntry *e = &s->profile[pc / 4];
+	e->executed++;
+
+	uint8_t op = s->decoded[pc / 4].op;
+	if (op >= OP_BEQ && op <= OP_BGEU && s->pc != pc + 4) e->taken++;
+}
+
+// Counts a memory access made by the instruction at `s->pc`, along with
+// the cache misses it caused
+void profile_access(Simulator *s, int is_write, size_t misses) {
+	if (s->pc >= s->text_end) return;
+	ProfileEntry *e = &s->profile[s->pc / 4];
+	if (is_write) e->stores++;
+	else e->loads++;
+	e->misses += misses;
+}
+
+// Counters summed over the instructions following a label
+typedef struct LabelProfile {
+	char *name;
+	ProfileEntry total;
+} LabelProfile;
+
+static void profile_add(ProfileEntry *to, ProfileEntry *e) {
+	to->executed += e->executed;
+	to->loads += e->loads;
+	to->stores += e->stores;
+	to->misses += e->misses;
+	to->taken += e->taken;
+}
+
+// Orders by executed instructions, then by cache misses, descending
+static int profile_cmp(ProfileEntry *a, ProfileEntry *b) {
+	if (a->executed != b->executed) return (a->executed < b->executed)? 1: -1;
+	if (a->misses != b->misses) return (a->misses < b->misses)? 1: -1;
+	return 0;
+}
+
+static int label_cmp(const void *a, const void *b) {
+	return profile_cmp(&((LabelProfile*)a)->total, &((LabelProfile*)b)->total);
+}
+
+// Ties are broken by address so the report is stable
+static int ins_cmp(const void *a, const void *b) {
+	ProfileEntry *x = *(ProfileEntry**)a, *y = *(ProfileEntry**)b;
+	int c = profile_cmp(x, y);
+	if (c) return c;
+	return (x < y)? -1: 1;
+}
+
+static double percent(uint64_t n, uint64_t total) {
+	return total? 100.0 * n / total: 0;
+}
+
+// Prints the totals, the labels ranked by executed instructions, and the
+// hottest instructions with their source lines
+void profile_report(Simulator *s) {
+	if (!s->profile) {
+		printf("Profiling is not enabled\n");
+		return;
+	}
+
+	ProfileEntry total = {0};
+	for (size_t i = 0; i < s->num_ins; i++) {
+		profile_add(&total, &s->profile[i]);
+	}
+	printf("Profile: %lu instructions, %lu loads, %lu stores, %lu cache misses, %lu taken branches\n",
+		total.executed, total.loads, total.stores, total.misses, total.taken);
+
+	// Instructions before the first label belong to `main`. Labels are
+	// stored in the order of their offsets.
+	LabelProfile *labels = calloc(s->labels->len + 1, sizeof(LabelProfile));
+	labels[0].name = "main";
+	int cur = 0;
+	for (size_t i = 0; i < s->num_ins; i++) {
+		while (cur < s->labels->len && s->labels->data[cur].offset <= 4 * i) cur++;
+		profile_add(&labels[cur].total, &s->profile[i]);
+	}
+	for (int i = 0; i < s->labels->len; i++) {
+		labels[i + 1].name = s->labels->data[i].lbl_name;
+	}
+	qsort(labels, s->labels->len + 1, sizeof(LabelProfile), label_cmp);
+
+	printf("\n%-20s %12s %7s %10s %10s %10s %10s\n",
+		"Label", "Executed", "%", "Loads", "Stores", "Misses", "Taken");
+	for (int i = 0; i <= s->labels->len && labels[i].total.executed; i++) {
+		ProfileEntry *e = &labels[i].total;
+		printf("%-20s %12lu %6.2f%% %10lu %10lu %10lu %10lu\n",
+			labels[i].name, e->executed, percent(e->executed, total.executed),
+			e->loads, e->stores, e->misses, e->taken);
+	}
+	free(labels);
+
+	ProfileEntry **order = malloc(s->num_ins * sizeof(ProfileEntry*));
+	for (size_t i = 0; i < s->num_ins; i++) order[i] = &s->profile[i];
+	qsort(order, s->num_ins, sizeof(ProfileEntry*), ins_cmp);
+
+	printf("\n%-10s %6s %12s %7s %10s %10s %10s %10s  %s\n",
+		"PC", "Line", "Executed", "%", "Loads", "Stores", "Misses", "Taken", "Source");
+	for (size_t i = 0; i < s->num_ins && i < PROFILE_TOP; i++) {
+		ProfileEntry *e = order[i];
+		size_t n = e - s->profile;
+		if (!e->executed) break;
+		printf("0x%08lx %6d %12lu %6.2f%% %10lu %10lu %10lu %10lu  ",
+			4 * n, s->ins_lines[n], e->executed,
+			percent(e->executed, total.executed),
+			e->loads, e->stores, e->misses, e->taken);
+		print_line(s->src, s->ins_lines[n]);
+		printf("\n");
+	}
+	free(order);
+}
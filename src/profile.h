@@ -0,0 +1,17 @@
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct Simulator;
+
+// Counters for one instruction of the text segment
+typedef struct ProfileEntry {
+	uint64_t executed, loads, stores, misses, taken;
+} ProfileEntry;
+
+void profile_enable(struct Simulator *s);
+void profile_disable(struct Simulator *s);
+void profile_retire(struct Simulator *s, uint64_t pc);
+void profile_access(struct Simulator *s, int is_write, size_t misses);
+void profile_report(struct Simulator *s);
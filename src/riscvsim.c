@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef RISCVSIM_H
+#include "riscvsim.h"
+#endif
+
+#ifndef SIMULATOR_H
+#include "simulator.h"
+#endif
+
+// Creates a simulator with no cache and nothing loaded
+RvSim *rvsim_create(void) {
+    Simulator *s = calloc(1, sizeof(Simulator));
+    s->quiet = 1;
+    s->log_disabled = 1;
+    sim_init(s);
+    return s;
+}
+
+void rvsim_destroy(RvSim *s) {
+    sim_uninit(s);
+    free(s);
+}
+
+// Enables the cache with the given config, or disables it if `cfg` is
+// NULL. Takes effect from the next `rvsim_load`.
+int rvsim_set_cache(RvSim *s, const RvSimCacheConfig *cfg) {
+    if (!cfg) {
+        s->cache_enabled = 0;
+        return 0;
+    }
+
+    size_t ways = cfg->associativity? cfg->associativity: 1;
+    if (cfg->block_size == 0 || cfg->size < cfg->block_size * ways) return -1;
+
+    s->cache_cfg.size = cfg->size;
+    s->cache_cfg.block_size = cfg->block_size;
+    s->cache_cfg.associativity = cfg->associativity;
+    s->cache_cfg.replacement_policy = cfg->replacement_policy;
+    s->cache_cfg.writeback_policy = cfg->write_policy;
+    s->cache_cfg.seed = cfg->seed;
+    s->cache_enabled = 1;
+    return 0;
+}
+
+// Selects the single-pass assembler, which keeps no parse nodes, for
+// the following loads
+void rvsim_set_one_pass(RvSim *s, int enabled) {
+    s->one_pass = enabled;
+}
+
+// Sets the number of threads used to assemble large sources
+void rvsim_set_asm_threads(RvSim *s, int num_threads) {
+    s->asm_threads = num_threads;
+}
+
+// Assembles and loads a program from `len` bytes of source, or loads
+// the executable if the bytes are an ELF file. Returns 0 on success;
+// otherwise `rvsim_error` describes the problem.
+int rvsim_load(RvSim *s, const char *src, size_t len) {
+    if (elf_detect(src, len)) {
+        sim_init(s);
+        return elf_load(s, (const uint8_t*)src, len);
+    }
+
+    char *buf = malloc(len + 1);
+    memcpy(buf, src, len);
+    buf[len] = '\0';
+
+    sim_init(s);
+    return sim_load_source(s, buf, len, 0);
+}
+
+const char *rvsim_error(RvSim *s) {
+    return s->error;
+}
+
+// Runs up to `max_instructions` instructions. Returns RVSIM_END when the
+// program finishes, RVSIM_BREAKPOINT (also for `ebreak`) or RVSIM_LIMIT
+// otherwise. A program ended by an illegal instruction, an unsupported
+// system call or a fault also returns RVSIM_END, with `rvsim_error` set.
+int rvsim_run(RvSim *s, uint64_t max_instructions) {
+    switch (sim_run_for(s, max_instructions)) {
+        case STOP_END: return RVSIM_END;
+        case STOP_BREAKPOINT:
+        case STOP_WATCHPOINT: return RVSIM_BREAKPOINT;
+        default: return RVSIM_LIMIT;
+    }
+}
+
+// Stops `rvsim_run` before the instruction on a source line. Loading a
+// program clears all breakpoints.
+int rvsim_add_breakpoint(RvSim *s, int line) {
+    BreakPointVec *b = s->breaks;
+    if (b->len >= b->cap) {
+        b->data = realloc(b->data, (b->cap + 1024) * sizeof(int));
+        b->cap += 1024;
+    }
+    b->data[b->len++] = line;
+    sim_update_breakpoints(s);
+    return 0;
+}
+
+void rvsim_get_regs(RvSim *s, RvSimRegs *regs) {
+    regs->pc = s->pc;
+    memcpy(regs->x, s->regs, sizeof(regs->x));
+}
+
+// Copies guest memory as the program sees it, including data in dirty
+// cache blocks, without counting cache accesses
+int rvsim_read_mem(RvSim *s, uint64_t addr, void *buf, size_t len) {
+    if (addr >= MEM_SIZE || len > MEM_SIZE - addr) return -1;
+    uint8_t *bytes = buf;
+    for (size_t i = 0; i < len; i++) bytes[i] = mem_peek(s, addr + i, 1);
+    return 0;
+}
+
+void rvsim_get_stats(RvSim *s, RvSimStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->instructions = s->retired;
+    if (s->cache_enabled && s->cache) {
+        stats->hits = s->cache->hits;
+        stats->misses = s->cache->misses;
+        stats->writebacks = s->cache->writebacks;
+        stats->accesses = stats->hits + stats->misses;
+    }
+}
+
+void rvsim_set_mem_callback(RvSim *s, RvSimMemCallback cb, void *data) {
+    s->mem_hook = cb;
+    s->mem_hook_data = data;
+}
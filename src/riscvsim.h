@@ -0,0 +1,53 @@
+#define RISCVSIM_H
+
+/*
+   Embedding API for the simulator, built as libriscvsim.a/.so.
+   Programs are assembled from memory, executed in bounded slices and
+   inspected through plain structs, without anything being printed.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct Simulator RvSim;
+
+enum { RVSIM_FIFO, RVSIM_LRU, RVSIM_RANDOM };
+enum { RVSIM_WRITEBACK, RVSIM_WRITETHROUGH };
+
+// Return values of `rvsim_run`
+enum { RVSIM_END, RVSIM_BREAKPOINT, RVSIM_LIMIT };
+
+typedef struct RvSimCacheConfig {
+    size_t size, block_size, associativity; // Associativity 0 means fully associative
+    int replacement_policy, write_policy;
+    uint64_t seed;
+} RvSimCacheConfig;
+
+typedef struct RvSimRegs {
+    uint64_t pc, x[32];
+} RvSimRegs;
+
+typedef struct RvSimStats {
+    uint64_t instructions;
+    size_t accesses, hits, misses, writebacks;
+} RvSimStats;
+
+// Called for every load and store with the PC of the instruction
+typedef void (*RvSimMemCallback)(void *data, uint64_t pc, uint64_t addr, size_t num_bytes, int is_write);
+
+RvSim *rvsim_create(void);
+void rvsim_destroy(RvSim *s);
+
+int rvsim_set_cache(RvSim *s, const RvSimCacheConfig *cfg);
+void rvsim_set_one_pass(RvSim *s, int enabled);
+void rvsim_set_asm_threads(RvSim *s, int num_threads);
+int rvsim_load(RvSim *s, const char *src, size_t len);
+const char *rvsim_error(RvSim *s);
+
+int rvsim_run(RvSim *s, uint64_t max_instructions);
+int rvsim_add_breakpoint(RvSim *s, int line);
+
+void rvsim_get_regs(RvSim *s, RvSimRegs *regs);
+int rvsim_read_mem(RvSim *s, uint64_t addr, void *buf, size_t len);
+void rvsim_get_stats(RvSim *s, RvSimStats *stats);
+void rvsim_set_mem_callback(RvSim *s, RvSimMemCallback cb, void *data);
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#ifndef SAMPLE_H
+#include "sample.h"
+#endif
+
+#ifndef SIMULATOR_H
+#include "simulator.h"
+#endif
+
+/*
+   Sampled simulation. Most of the program is fast-forwarded with
+   `sim_fast_forward`, which keeps the cache's contents coherent but
+   leaves its statistics and replacement state untouched. Each sample
+   first runs a warm-up period in detail to refill the cache, and then a
+   measurement window whose cache events are recorded. The totals for
+   the whole program are extrapolated from the per-instruction rates of
+   the windows, with 95% confidence intervals over the samples.
+*/
+
+// z-score of a two-sided 95% confidence interval
+#define SAMPLE_Z 1.96
+
+// Cache events of one measurement window
+typedef struct Sample {
+    uint64_t instructions;
+    size_t accesses, misses, writebacks;
+} Sample;
+
+// Parses `skip,warmup,window[,period]`
+int sample_parse(SampleConfig *cfg, char *spec) {
+    cfg->period = 0;
+    int n = sscanf(spec, "%lu,%lu,%lu,%lu", &cfg->skip, &cfg->warmup, &cfg->window, &cfg->period);
+    if (n < 3 || cfg->window == 0 || (cfg->period && cfg->period < cfg->warmup + cfg->window)) {
+        printf("Invalid sample spec; expected skip,warmup,window[,period] with period >= warmup + window\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Runs `max` instructions in detail. Breakpoints and watchpoints don't
+// stop sampling.
+static StopReason run_detailed(Simulator *s, uint64_t max) {
+    uint64_t limit = s->retired + max;
+    StopReason reason;
+    do {
+        s->watch_hit.hit = 0;
+        reason = sim_run_for(s, limit - s->retired);
+    } while (reason == STOP_BREAKPOINT || reason == STOP_WATCHPOINT);
+    return reason;
+}
+
+// Estimates the total of an event over `total` instructions from its
+// rate in each sample. Returns the estimate and prints it along with its
+// confidence interval.
+static double sample_estimate(const char *name, double *rates, size_t n, uint64_t total) {
+    double mean = 0, var = 0;
+    for (size_t i = 0; i < n; i++) mean += rates[i];
+    mean /= n;
+    for (size_t i = 0; i < n; i++) var += (rates[i] - mean) * (rates[i] - mean);
+
+    printf("Estimated %s: %.0f", name, mean * total);
+    if (n > 1) printf(" +/- %.0f", SAMPLE_Z * sqrt(var / (n - 1) / n) * total);
+    printf(" (%.4f per instruction)\n", mean);
+    return mean * total;
+}
+
+// Runs the loaded program to the end, taking samples as described by
+// `cfg`, and prints the extrapolated cache statistics
+int sim_sample(Simulator *s, SampleConfig *cfg) {
+    if (!s->cache_enabled) {
+        printf("Cache is disabled\n");
+        return -1;
+    }
+    if (!s->execution_in_progress) {
+        printf("No program running\n");
+        return -1;
+    }
+
+    size_t len = 0, cap = 64;
+    Sample *samples = malloc(cap * sizeof(Sample));
+    uint64_t start = s->retired, measured = 0;
+    Cache *c = s->cache;
+
+    StopReason reason = sim_fast_forward(s, cfg->skip);
+    while (reason != STOP_END) {
+        reason = run_detailed(s, cfg->warmup);
+        if (reason == STOP_END) break;
+
+        Sample smp = { s->retired, c->hits + c->misses, c->misses, c->writebacks };
+        reason = run_detailed(s, cfg->window);
+        smp.instructions = s->retired - smp.instructions;
+        smp.accesses = c->hits + c->misses - smp.accesses;
+        smp.misses = c->misses - smp.misses;
+        smp.writebacks = c->writebacks - smp.writebacks;
+
+        if (smp.instructions) {
+            if (len == cap) {
+                cap *= 2;
+                samples = realloc(samples, cap * sizeof(Sample));
+            }
+            samples[len++] = smp;
+            measured += smp.instructions;
+        }
+        if (reason == STOP_END) break;
+
+        uint64_t gap = cfg->period? cfg->period - cfg->warmup - cfg->window: UINT64_MAX;
+        reason = sim_fast_forward(s, gap);
+    }
+
+    if (s->error) printf("%s", s->error);
+    uint64_t total = s->retired - start;
+    printf("Sampled %zu windows: %lu of %lu instructions measured (%.2f%%)\n",
+        len, measured, total, total? 100.0 * measured / total: 0);
+    if (len) {
+        double *rates = malloc(len * sizeof(double));
+        for (size_t i = 0; i < len; i++) rates[i] = (double)samples[i].accesses / samples[i].instructions;
+        double accesses = sample_estimate("accesses", rates, len, total);
+        for (size_t i = 0; i < len; i++) rates[i] = (double)samples[i].misses / samples[i].instructions;
+        double misses = sample_estimate("misses", rates, len, total);
+        for (size_t i = 0; i < len; i++) rates[i] = (double)samples[i].writebacks / samples[i].instructions;
+        sample_estimate("writebacks", rates, len, total);
+        printf("Estimated hit rate: %.2lf\n", accesses? 1 - misses / accesses: 0);
+        free(rates);
+    } else {
+        printf("No samples were taken\n");
+    }
+
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,15 @@
+#define SAMPLE_H
+
+#include <stdint.h>
+
+struct Simulator;
+
+// Instructions to skip before the first sample, then the warm-up and
+// measurement window of each sample. Samples start every `period`
+// instructions; a period of 0 takes a single sample.
+typedef struct SampleConfig {
+    uint64_t skip, warmup, window, period;
+} SampleConfig;
+
+int sample_parse(SampleConfig *cfg, char *spec);
+int sim_sample(struct Simulator *s, SampleConfig *cfg);
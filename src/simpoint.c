@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#ifndef SIMPOINT_H
+#include "simpoint.h"
+#endif
+
+#ifndef SIMULATOR_H
+#include "simulator.h"
+#endif
+
+/*
+   SimPoint-style phase analysis. The program is fast-forwarded in
+   intervals of a fixed number of instructions, and each interval is
+   summarised by a basic block vector: the number of instructions it
+   executed in each basic block. The vectors are normalised, randomly
+   projected down to SIMPOINT_DIMS dimensions and clustered with
+   k-means. The interval closest to the centre of each cluster is a
+   simulation point, weighted by the share of intervals in its cluster.
+*/
+
+#define SIMPOINT_DIMS 15
+#define SIMPOINT_ITERATIONS 100
+#define SIMPOINT_SEED 0x5eed
+
+// xorshift64* generator, so the clustering is reproducible
+static uint64_t simpoint_rand(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1d;
+}
+
+static double rand_unit(uint64_t *state) {
+    return (simpoint_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Numbers the basic blocks of the text segment. A block starts at the
+// first instruction, at every branch or jump target and after every
+// branch or jump. Returns the number of blocks.
+static size_t find_blocks(Simulator *s, uint32_t *block_of) {
+    uint8_t *leader = calloc(s->num_ins + 1, sizeof(uint8_t));
+    leader[0] = 1;
+    for (size_t i = 0; i < s->num_ins; i++) {
+        DecodedIns *d = &s->decoded[i];
+        int branch = d->op >= OP_BEQ && d->op <= OP_BGEU;
+        if (branch || d->op == OP_JAL || d->op == OP_JALR) leader[i + 1] = 1;
+        if (branch || d->op == OP_JAL) {
+            int64_t target = (int64_t)i + d->imm / 4;
+            if (target >= 0 && target < s->num_ins) leader[target] = 1;
+        }
+    }
+
+    size_t num_blocks = 0;
+    for (size_t i = 0; i < s->num_ins; i++) {
+        if (leader[i]) num_blocks++;
+        block_of[i] = num_blocks - 1;
+    }
+    free(leader);
+    return num_blocks;
+}
+
+static double distance(const double *a, const double *b) {
+    double d = 0;
+    for (int i = 0; i < SIMPOINT_DIMS; i++) d += (a[i] - b[i]) * (a[i] - b[i]);
+    return d;
+}
+
+// Clusters `n` points into `k` clusters with k-means, seeded with
+// k-means++. Writes the cluster of each point to `cluster`.
+static void kmeans(double *points, size_t n, int k, int *cluster, double *centers) {
+    uint64_t state = SIMPOINT_SEED;
+    double *dist = malloc(n * sizeof(double));
+
+    // k-means++: each new center is picked with probability proportional
+    // to the squared distance from the nearest center
+    memcpy(centers, &points[(simpoint_rand(&state) % n) * SIMPOINT_DIMS], SIMPOINT_DIMS * sizeof(double));
+    for (size_t i = 0; i < n; i++) dist[i] = distance(&points[i * SIMPOINT_DIMS], centers);
+    for (int c = 1; c < k; c++) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) sum += dist[i];
+        double r = rand_unit(&state) * sum;
+        size_t pick = n - 1;
+        for (size_t i = 0; i < n; i++) {
+            r -= dist[i];
+            if (r < 0) {
+                pick = i;
+                break;
+            }
+        }
+        double *center = &centers[c * SIMPOINT_DIMS];
+        memcpy(center, &points[pick * SIMPOINT_DIMS], SIMPOINT_DIMS * sizeof(double));
+        for (size_t i = 0; i < n; i++) {
+            double d = distance(&points[i * SIMPOINT_DIMS], center);
+            if (d < dist[i]) dist[i] = d;
+        }
+    }
+
+    int *count = malloc(k * sizeof(int));
+    for (size_t i = 0; i < n; i++) cluster[i] = -1;
+    for (int iter = 0; iter < SIMPOINT_ITERATIONS; iter++) {
+        int changed = 0;
+        for (size_t i = 0; i < n; i++) {
+            int best = 0;
+            double best_dist = DBL_MAX;
+            for (int c = 0; c < k; c++) {
+                double d = distance(&points[i * SIMPOINT_DIMS], &centers[c * SIMPOINT_DIMS]);
+                if (d < best_dist) {
+                    best = c;
+                    best_dist = d;
+                }
+            }
+            if (cluster[i] != best) changed = 1;
+            cluster[i] = best;
+        }
+        if (!changed) break;
+
+        // Move each center to the mean of its points. Empty clusters
+        // keep their center.
+        memset(count, 0, k * sizeof(int));
+        for (size_t i = 0; i < n; i++) count[cluster[i]]++;
+        for (int c = 0; c < k; c++) {
+            if (count[c]) memset(&centers[c * SIMPOINT_DIMS], 0, SIMPOINT_DIMS * sizeof(double));
+        }
+        for (size_t i = 0; i < n; i++) {
+            for (int j = 0; j < SIMPOINT_DIMS; j++) {
+                centers[cluster[i] * SIMPOINT_DIMS + j] += points[i * SIMPOINT_DIMS + j] / count[cluster[i]];
+            }
+        }
+    }
+
+    free(count);
+    free(dist);
+}
+
+// Runs the loaded program to the end functionally, collecting a basic
+// block vector every `interval` instructions. The vectors are written to
+// `bbv_file` in SimPoint's format if it is not NULL. Prints up to `k`
+// simulation points and their weights.
+int sim_simpoints(Simulator *s, uint64_t interval, int k, char *bbv_file) {
+    if (!s->execution_in_progress) {
+        printf("No program running\n");
+        return -1;
+    }
+    if (interval == 0 || k < 1) {
+        printf("Invalid interval or number of clusters\n");
+        return -1;
+    }
+
+    FILE *f = NULL;
+    if (bbv_file && !(f = fopen(bbv_file, "w"))) {
+        printf("Could not open BBV file\n");
+        return -1;
+    }
+
+    uint32_t *block_of = malloc(s->num_ins * sizeof(uint32_t));
+    size_t num_blocks = find_blocks(s, block_of);
+
+    // Each block is projected onto SIMPOINT_DIMS random directions
+    uint64_t state = SIMPOINT_SEED;
+    double *projection = malloc(num_blocks * SIMPOINT_DIMS * sizeof(double));
+    for (size_t i = 0; i < num_blocks * SIMPOINT_DIMS; i++) {
+        projection[i] = 2 * rand_unit(&state) - 1;
+    }
+
+    uint64_t *bbv = malloc(num_blocks * sizeof(uint64_t));
+    size_t len = 0, cap = 64;
+    double *points = malloc(cap * SIMPOINT_DIMS * sizeof(double));
+    uint64_t start = s->retired;
+    s->ins_counts = calloc(s->num_ins, sizeof(uint64_t));
+
+    StopReason reason = STOP_LIMIT;
+    while (reason != STOP_END) {
+        uint64_t before = s->retired;
+        reason = sim_fast_forward(s, interval);
+        uint64_t executed = s->retired - before;
+        if (!executed) break;
+
+        memset(bbv, 0, num_blocks * sizeof(uint64_t));
+        for (size_t i = 0; i < s->num_ins; i++) {
+            bbv[block_of[i]] += s->ins_counts[i];
+        }
+        memset(s->ins_counts, 0, s->num_ins * sizeof(uint64_t));
+
+        if (len == cap) {
+            cap *= 2;
+            points = realloc(points, cap * SIMPOINT_DIMS * sizeof(double));
+        }
+        double *p = &points[len++ * SIMPOINT_DIMS];
+        memset(p, 0, SIMPOINT_DIMS * sizeof(double));
+
+        if (f) fprintf(f, "T");
+        for (size_t b = 0; b < num_blocks; b++) {
+            if (!bbv[b]) continue;
+            if (f) fprintf(f, ":%zu:%lu ", b + 1, bbv[b]);
+            double share = (double)bbv[b] / executed;
+            for (int j = 0; j < SIMPOINT_DIMS; j++) p[j] += share * projection[b * SIMPOINT_DIMS + j];
+        }
+        if (f) fprintf(f, "\n");
+    }
+
+    free(s->ins_counts);
+    s->ins_counts = NULL;
+    free(bbv);
+    free(projection);
+    free(block_of);
+    if (f) fclose(f);
+
+    if (s->error) printf("%s", s->error);
+    printf("Collected %zu intervals of %lu instructions over %zu basic blocks\n",
+        len, interval, num_blocks);
+    if (!len) {
+        free(points);
+        return 0;
+    }
+
+    if (k > len) k = len;
+    int *cluster = malloc(len * sizeof(int));
+    double *centers = malloc(k * SIMPOINT_DIMS * sizeof(double));
+    kmeans(points, len, k, cluster, centers);
+
+    // The representative of a cluster is its interval nearest the center
+    printf("%-10s %-28s %s\n", "Interval", "Instructions", "Weight");
+    for (int c = 0; c < k; c++) {
+        size_t best = len, size = 0;
+        double best_dist = DBL_MAX;
+        for (size_t i = 0; i < len; i++) {
+            if (cluster[i] != c) continue;
+            size++;
+            double d = distance(&points[i * SIMPOINT_DIMS], &centers[c * SIMPOINT_DIMS]);
+            if (d < best_dist) {
+                best = i;
+                best_dist = d;
+            }
+        }
+        if (!size) continue;
+
+        char range[64];
+        uint64_t first = start + best * interval;
+        snprintf(range, sizeof(range), "%lu-%lu", first, first + interval - 1);
+        printf("%-10zu %-28s %.4f\n", best, range, (double)size / len);
+    }
+
+    free(centers);
+    free(cluster);
+    free(points);
+    return 0;
+}
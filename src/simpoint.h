@@ -0,0 +1,7 @@
+#define SIMPOINT_H
+
+#include <stdint.h>
+
+struct Simulator;
+
+int sim_simpoints(struct Simulator *s, uint64_t interval, int k, char *bbv_file);
@@ -1,44 +1,64 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifndef SIMULATOR_H
 #include "simulator.h"
 #endif
 
-#define BUF_CHUNK_SIZE 4096
+#ifndef CHECKPOINT_H
+#include "checkpoint.h"
+#endif
+
 #define PN_CHUNK_SIZE 4096
-#define DATA_SEGMENT_START 0x10000 
-
-void sim_stack_push(Simulator *s, char *label, int line);
-void sim_stack_pop(Simulator *s);
-
-// Reads an entire file into a buffer
-char *read_file(FILE *f) {
-	size_t len = 0, cap = 0;
-	char *buf = NULL;
-	while(1) {
-		size_t available = cap - len;
-		// Reallocate buffer if no space is available
-		if (available <= 1) {
-			buf = realloc(buf, cap + BUF_CHUNK_SIZE);
-			for (int i = cap; i < cap + BUF_CHUNK_SIZE; i++) {
-				buf[i] = 0;
-			}
-			cap += BUF_CHUNK_SIZE;
-		}
 
-		fgets(&buf[len], available, f);
-		// fgets doesn't return the number of characters read, so strlen is used.
-		size_t n = strlen(&buf[len]);
-		len += n; 
-		
-		// If the number of bytes read is less than n, that means we either hit
-		// a newline or the EOF.
-		if (n < available && feof(f)) {
-			return buf; 
-		}	
+/*
+   Source files are mapped rather than read, so loading a large program
+   costs page faults instead of copies. The assembler and the error
+   printers expect a NUL after the last byte; a mapping provides one in
+   the zero-filled tail of its last page, so only a file whose size is a
+   multiple of the page size (or an empty one) is read into a heap
+   buffer instead.
+*/
+char *map_source(char *file, size_t *len, int *mapped) {
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+	*len = st.st_size;
+
+	if (*len % sysconf(_SC_PAGESIZE) != 0) {
+		char *map = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			close(fd);
+			*mapped = 1;
+			return map;
+		}
 	}
+
+	char *buf = malloc(*len + 1);
+	size_t n = 0;
+	ssize_t r;
+	while (n < *len && (r = read(fd, &buf[n], *len - n)) > 0) n += r;
+	close(fd);
+	buf[n] = '\0';
+	*len = n;
+	*mapped = 0;
+	return buf;
+}
+
+// Releases a source buffer returned by `map_source`
+static void free_source(char *src, size_t len, int mapped) {
+	if (mapped) munmap(src, len);
+	else free(src);
 }
 
 void print_line(char *src, int line) {
@@ -71,8 +91,8 @@ void print_line(char *src, int line) {
 	printf("%.*s", (int)(end - start), start);
 }
 
-// Prints a parse error
-void print_parse_error(char *src, ParseErr *err) {	
+// Prints a parse error to `f`
+void print_parse_error(FILE *f, char *src, ParseErr *err) {	
 
 	// Moves to the starting line of the error
 	char *ptr = src;
@@ -87,27 +107,27 @@ void print_parse_error(char *src, ParseErr *err) {
 	char *end = ptr;
 
 
-	printf("Error on line %d: %s\n", err->line, err->msg);
+	fprintf(f, "Error on line %d: %s\n", err->line, err->msg);
 
 
 
 	// Add arrows underneath to point to error position
-	printf("%.*s\n", (int)(end - start), start);
+	fprintf(f, "%.*s\n", (int)(end - start), start);
 	for (int i = 1; i < err->scol; i++) {
 		if (start[i] == '\t') {
-			printf("\t");
+			fprintf(f, "\t");
 		} else {
-			printf(" ");
+			fprintf(f, " ");
 		}
 	}
 	for (int i = err->scol; i < err->ecol; i++) {
-		printf("^");
+		fprintf(f, "^");
 	}
-	printf("\n");
+	fprintf(f, "\n");
 }
 
-// Prints an emit error
-void print_emit_error(char *src, EmitErr *err) {
+// Prints an emit error to `f`
+void print_emit_error(FILE *f, char *src, EmitErr *err) {
 	// Moves to the starting line`of the error
 	char *ptr = src;
 	for (int i = 1; i < err->line; i++) {
@@ -120,12 +140,47 @@ void print_emit_error(char *src, EmitErr *err) {
 	while (*ptr != '\n' && *ptr != '\0') ptr++;	
 	char *end = ptr;
 
-	printf("Error on line %d: %s\n", err->line, err->msg);	
-	printf("%.*s\n", (int)(end - start), start);
+	fprintf(f, "Error on line %d: %s\n", err->line, err->msg);	
+	fprintf(f, "%.*s\n", (int)(end - start), start);
 }
 
 
+// Frees everything owned by the simulator's current program and cache
+void sim_free_program(Simulator *s) {
+	if (s->breaks) free(s->breaks->data);
+	if (s->watches) free(s->watches->data);
+	if (s->stack) free(s->stack->data);
+	free(s->breaks);
+	free(s->watches);
+	free(s->stack);
+	free(s->labels);
+	if (s->src) free_source(s->src, s->src_len, s->src_mapped);
+	free(s->decoded);
+	free(s->ins_lines);
+	free(s->bp_at);
+	free(s->profile);
+	arena_free(&s->arena);
+	s->breaks = NULL;
+	s->watches = NULL;
+	s->stack = NULL;
+	s->labels = NULL;
+	s->src = NULL;
+	s->nodes = NULL;
+	s->decoded = NULL;
+	s->ins_lines = NULL;
+	s->bp_at = NULL;
+	s->profile = NULL;
+
+	if (s->cache) {
+		if (s->cache->output_file) fclose(s->cache->output_file);
+		cache_free(s->cache);
+		free(s->cache);
+		s->cache = NULL;
+	}
+}
+
 void sim_init(Simulator *s) {
+	sim_free_program(s);
 	s->pc = 0;
 
 	s->breaks = malloc(sizeof(BreakPointVec));
@@ -133,6 +188,10 @@ void sim_init(Simulator *s) {
 	s->breaks->cap = 0;
 	s->breaks->data = NULL;
 
+	s->watches = calloc(1, sizeof(WatchVec));
+	memset(s->watch_pages, 0, sizeof(s->watch_pages));
+	s->watch_hit.hit = 0;
+
 	s->stack = malloc(sizeof(StackVec));
 	s->stack->len = 0;
 	s->stack->cap = 0;
@@ -145,6 +204,17 @@ void sim_init(Simulator *s) {
 
 	sim_stack_push(s, "main", 0);
 
+	s->num_nodes = 0;
+	s->num_ins = 0;
+	s->text_end = 0;
+	s->data_len = 0;
+	s->elf = 0;
+	s->trap = TRAP_NONE;
+	s->fault_addr = s->fault_pc = 0;
+	s->retired = 0;
+	s->execution_in_progress = 0;
+	undo_reset(s);
+
 	for (int i = 0; i < 32; i++) {
 		s->regs[i] = 0;
 	}
@@ -155,6 +225,7 @@ void sim_init(Simulator *s) {
 
 	// If cache is enabled, create a cache and initialize it	
 	if (s->cache_enabled) {
+		if (s->seeded) s->cache_cfg.seed = s->seed;
 		s->cache = malloc(sizeof(Cache));
 		cache_init(s->cache, &s->cache_cfg);
 		s->cache->mem = s->mem;
@@ -162,406 +233,339 @@ void sim_init(Simulator *s) {
 }
 
 void sim_uninit(Simulator *s) {
-	if (s->cache_enabled) {
-		fclose(s->cache->output_file);
-	}
+	sim_free_program(s);
+	undo_disable(s);
+	free(s->pair_counts);
+	free(s->error);
+	s->pair_counts = NULL;
+	s->error = NULL;
 }
 
-int sim_load(Simulator *s, char *file) {
-	FILE *fin = fopen(file, "r");	
-	if (!fin) {
-		printf("Could not open input file\n");
-		return -1;
-	}
+// Cleans up after a failed load. Instructions and data may already have
+// been written to memory, which is cleared so that nothing runs.
+static void discard_load(Simulator *s, char *src, size_t len, int mapped, LineVec *lines) {
+	memset(s->mem, 0, MEM_SIZE);
+	s->num_ins = 0;
+	free_source(src, len, mapped);
+	free(lines->data);
+}
 
-	char* src = read_file(fin);
-	fclose(fin);
+// Assembles a program from `len` bytes of source followed by a NUL. The
+// simulator takes ownership of the buffer, which is unmapped rather than
+// freed if `mapped` is set. On failure the error message is left in
+// `s->error` and a non-zero value is returned.
+int sim_load_source(Simulator *s, char *src, size_t len, int mapped) {
+	free(s->error);
+	s->error = NULL;
 
 	Lexer l;
-	lexer_init(&l, src);
+	lexer_init(&l, src, len);
 	Parser p;
 	ParseErr err = {0, "", 0, 0, 0};
-	parser_init(&p, &l);
+	parser_init(&p, &l, &s->arena);
 
 	ParseNodeVec pn = {0};
-	DataVec d = {0};
+	// Data is parsed straight into the data segment
+	DataVec d = { 0, MEM_SIZE - DATA_SEGMENT_START, &s->mem[DATA_SEGMENT_START], MEM_SIZE - DATA_SEGMENT_START };
+	LineVec lines = {0};
+	EmitErr err2 = {0, "", 0};
 
-	parse_all(&p, &pn, &d, &err);
+	size_t error_len;
+	FILE *error_stream;
+
+	// The single-pass assembler encodes straight into memory and reports
+	// its label and encoding errors in `err2` along with the parse. Large
+	// sources are split over `asm_threads` threads.
+	int parallel = s->asm_threads > 1 && len >= 2 * ASM_MIN_CHUNK;
+	if (s->one_pass) {
+		assemble(&p, s->mem, DATA_SEGMENT_START, &d, s->labels, &lines, &err, &err2);
+	} else if (parallel) {
+		parse_parallel(&s->arena, src, len, s->asm_threads, &pn, &d, &err);
+	} else {
+		parse_all(&p, &pn, &d, &err);
+	}
 	if (err.is_err) {
-		print_parse_error(src, &err);
+		error_stream = open_memstream(&s->error, &error_len);
+		print_parse_error(error_stream, src, &err);
+		fclose(error_stream);
+		discard_load(s, src, len, mapped, &lines);
 		return 1;
 	}
 
-	EmitErr err2 = {0, "", 0};
-    find_labels(pn.data, pn.len, s->labels, &err2);
-	if (err2.is_err) {
-		print_emit_error(src, &err2);
+	// The text segment has to end before the data segment starts, and
+	// the data segment before the end of memory
+	if (s->one_pass) {
+		s->num_ins = lines.len;
+	} else {
+		for (int i = 0; i < pn.len; i++) {
+			if (pn.data[i].type != LABEL) s->num_ins++;
+		}
+	}
+	if (4 * s->num_ins > DATA_SEGMENT_START || d.len > MEM_SIZE - DATA_SEGMENT_START) {
+		s->error = strdup("Error: Program does not fit in memory\n");
+		discard_load(s, src, len, mapped, &lines);
 		return -1;
 	}
 
-	emit_all(s->mem, pn.data, pn.len, s->labels, &err2);
+	if (!s->one_pass) {
+		find_labels(&s->arena, pn.data, pn.len, s->labels, &err2);
+		if (!err2.is_err && parallel) {
+			emit_parallel(&s->arena, s->mem, pn.data, pn.len, s->labels, s->asm_threads, &err2);
+		} else if (!err2.is_err) {
+			emit_all(&s->arena, s->mem, pn.data, pn.len, s->labels, &err2);
+		}
+	}
 	if (err2.is_err) {
-		print_emit_error(src, &err2);
+		error_stream = open_memstream(&s->error, &error_len);
+		print_emit_error(error_stream, src, &err2);
+		fclose(error_stream);
+		discard_load(s, src, len, mapped, &lines);
 		return -1;
 	}
 
     s->src = src;
+    s->src_len = len;
+    s->src_mapped = mapped;
     s->nodes = pn.data;  
+    s->num_nodes = pn.len;
+
+	s->data_len = d.len;
 
-	// Copy d into data segment
-	for (int i = 0; i < d.len; i++) {
-		s->mem[DATA_SEGMENT_START + i] = d.data[i];	
+	// Build the instruction-to-line table and pre-decode the text segment
+	if (s->one_pass) {
+		s->ins_lines = lines.data;
+	} else {
+		s->ins_lines = malloc(s->num_ins * sizeof(int));
+		for (int i = 0, n = 0; i < pn.len; i++) {
+			if (pn.data[i].type != LABEL) s->ins_lines[n++] = pn.data[i].line;
+		}
 	}
+	sim_load_finish(s);
+	return 0;
+}
+
+// Prepares a program whose text and data segments, labels and line
+// table are in place for running
+void sim_load_finish(Simulator *s) {
+	s->text_end = 4 * s->num_ins;
+	s->decoded = malloc(s->num_ins * sizeof(DecodedIns));
+	s->bp_at = calloc(s->num_ins + 1, sizeof(uint8_t));
+	if (s->profiling) s->profile = calloc(s->num_ins, sizeof(ProfileEntry));
+	if (s->cache) cache_attribute(s->cache, s->num_ins, MEM_SIZE);
+	sim_predecode(s);
 
 	s->execution_in_progress = 1;
+}
 
-	if (s->cache_enabled) {
-		file[strlen(file) - 2] = '\0';
-		char *cache_output = malloc(30 * sizeof(char));
-		sprintf(cache_output, "%s.output", file);
-		FILE *output_file = fopen(cache_output, "w");
-		s->cache->output_file = output_file;	
+// Opens the cache log for a program loaded from `file`. The log goes to
+// `log_file`, or to the program name with the extension `ext` replaced
+// by `.output` if none was given.
+static void open_cache_log(Simulator *s, char *file, const char *ext) {
+	if (!s->cache_enabled || s->log_disabled) return;
+	if (s->log_file) {
+		s->cache->output_file = fopen(s->log_file, "w");
+		return;
 	}
+	size_t n = strlen(file), e = strlen(ext);
+	if (n >= e && strcmp(&file[n - e], ext) == 0) n -= e;
+	char *cache_output = malloc(n + sizeof(".output"));
+	sprintf(cache_output, "%.*s.output", (int)n, file);
+	s->cache->output_file = fopen(cache_output, "w");
+	free(cache_output);
+}
 
+// Loads a program from an image written by `asm -o`, printing any errors
+int sim_load_image(Simulator *s, char *file) {
+	int status = image_load(s, file, 0);
+	if (status == -1) {
+		printf("Could not open image file\n");
+		return -1;
+	} else if (status) {
+		printf("Invalid program image\n");
+		return -1;
+	}
+	free(s->error);
+	s->error = NULL;
+	open_cache_log(s, file, ".img");
 	return 0;
 }
 
-uint64_t mem_read(Simulator *s, uint64_t addr, size_t num_bytes) {
-	if (s->cache_enabled) {
-		return cache_read(s->cache, addr, num_bytes);
-	} else {
-		uint64_t value = 0;
-		for (int i = 0; i < num_bytes; i++) {
-			value = (value << 8) + s->mem[addr + num_bytes - i - 1];
+// Loads a program from a source file, printing any errors. Files named
+// `*.img` are loaded as images and ELF files as executables instead.
+int sim_load(Simulator *s, char *file) {
+	size_t n = strlen(file);
+	if (n >= 4 && strcmp(&file[n - 4], ".img") == 0) return sim_load_image(s, file);
+
+	size_t len;
+	int mapped;
+	char *src = map_source(file, &len, &mapped);
+	if (!src) {
+		printf("Could not open input file\n");
+		return -1;
+	}
+
+	if (elf_detect(src, len)) {
+		int status = elf_load(s, (uint8_t*)src, len);
+		free_source(src, len, mapped);
+		if (status) {
+			printf("%s", s->error);
+			return status;
 		}
-		return value;
+		open_cache_log(s, file, ".elf");
+		return 0;
 	}
-}
 
-void mem_write(Simulator *s, uint64_t addr, uint64_t value, size_t num_bytes) {
-	if (s->cache_enabled) {
-		return cache_write(s->cache, addr, value, num_bytes);
+	// With an assembler cache, an image of the same source skips the
+	// assembler, and a freshly assembled program is stored as one
+	uint64_t hash = 0;
+	char *image = NULL;
+	if (s->asm_cache) {
+		hash = source_hash(src);
+		image = image_cache_path(s->asm_cache, hash);
+	}
+
+	int status;
+	if (image && image_load(s, image, hash) == 0) {
+		free(s->error);
+		s->error = NULL;
+		s->src = src;
+		s->src_len = len;
+		s->src_mapped = mapped;
+		status = 0;
 	} else {
-		for (int i = 0; i < num_bytes; i++) {
-			s->mem[addr + i] = value % 0xff;
-			value = value >> 8;
-		}
+		status = sim_load_source(s, src, len, mapped);
+		if (status == 0 && image) image_cache_store(s, s->asm_cache, hash);
+	}
+	free(image);
+	if (status) {
+		printf("%s", s->error);
+		return status;
 	}
-}
 
-void sim_run_one(Simulator *s) {
-    // Read 32-bits from index `pc` of memory
-    uint32_t ins = *(uint32_t*)(&s->mem[s->pc]);
-
-    int opcode = ins & 0b1111111;
-
-    switch (opcode) {
-        case 0b0110011:{// R format
-            int rd_idx = (ins >> 7) & 0b11111,
-        		funct3 = (ins >> 12) & 0b111,
-            	rs1_idx = (ins >> 15) & 0b11111,
-            	rs2_idx = (ins >> 20) & 0b11111,
-            	funct7 = (ins >> 25) & 0b1111111;
-
-            int64_t rs1 = s->regs[rs1_idx], rs2 = s->regs[rs2_idx], rd;
-            
-            switch(funct3) {
-                case 0x0:
-                    switch (funct7) {
-                        case 0x00: rd = rs1 + rs2; break; // add                    
-                        case 0x20: rd = rs1 - rs2; break; // sub
-                    }
-                    break;
-                case 0x4: // xor
-                    rd = rs1 ^ rs2;
-                    break;
-				case 0x6: // or
-					rd = rs1 | rs2;
-					break;
-				case 0x7: // and
-					rd = rs1 & rs2;
-					break;
-				case 0x1: // sll
-					rd = rs1 << rs2;
-					break;
-				case 0x5: 
-					switch(funct7) {
-                    	case 0x20: rd = rs1 >> rs2; break; // sra                   
-                    	case 0x00: //srl
-							if (rs1>>63 == -1){ // if the first bit is -1
-								rd = (int64_t) ((uint64_t)(rs1) >> (uint64_t)(rs2));
-								break;
-							}
-							else {	
-								rd = rs1 >> rs2; 
-								break;
-							}
-					}					
-					break;
-				case 0x2: // slt
-					rd = (rs1 < rs2)?1:0;
-					break;
-				case 0x3: // sltu
-					rd = ((int64_t)((uint64_t)rs1 < (uint64_t)rs2))?1:0;
-					break;
-
-            }
-	
-            s->regs[rd_idx] = rd;
-            break;
-		}
+	open_cache_log(s, file, ".s");
+	return 0;
+}
 
-		case 0b0010011:{ // I format arithmetic instructions
-            int rd_idx = (ins >> 7) & 0b11111,
-                funct3 = (ins >> 12) & 0b111,
-                rs1_idx = (ins >> 15) & 0b11111,
-                imm = ins >> 20;
-
-			// Sign extension
-			imm = imm | (0xfffff000 * (imm >> 11));
-
-            int64_t rs1 = s->regs[rs1_idx], rd;
-            
-            switch(funct3) {
-                case 0x0:
-					rd = rs1 + imm;  // addi           
-                    break;
-                case 0x4: 
-                    rd = rs1 ^ imm; //xori
-                    break;
-				case 0x6: // ori
-					rd = rs1 | imm;
-					break;
-				case 0x7: // andi
-					rd = rs1 & imm;
-					break;
-				case 0x1:{ // slli
-					int imm_second6 = imm & 0b000000111111;
-					rd = rs1 << (imm_second6);
-					break;
-				}
-				case 0x5: {
-					int imm_first6 = imm>>6;
-					int imm_second6 = imm & 0b000000111111;
-					switch(imm_first6){
-                    	case 0x10: rd = rs1 >> imm_second6; break; // srai             
-                    	case 0x00: //srli
-							if (rs1>>63 == -1){ // if the leading digit is 1
-								rd = (uint64_t) ((int64_t)(rs1) >> imm_second6);
-								break;
-							} else {	// if the leading digit is 0
-								rd = rs1 >> imm_second6; 
-								break;
-							}
-					}
-					break;
-				}					
-				break;
-				case 0x2: // slti
-					rd = (rs1 < imm)?1:0; // rs1 and imm are signed integers by default
-					break;
-				case 0x3: // sltiu
-					rd = ((uint64_t)rs1 < (uint32_t)imm)?1:0;
-					break;
-
-            }
-
-            s->regs[rd_idx] = rd;
-            break;
-		}
-		case 0b0000011:{ // I format load instructions
-			ins = (int32_t) ins;
-            int rd_idx = (ins >> 7) & 0b11111,
-                funct3 = (ins >> 12) & 0b111,
-                rs1_idx = (ins >> 15) & 0b11111,
-                imm = (ins >> 20);
-
-			// Sign extension
-			imm = imm | (0xfffff000 * (imm >> 11));
-   
-            int64_t rs1 = s->regs[rs1_idx], rd;
-			int64_t address = rs1 + imm;
-
-            switch(funct3) {
-                case 0x0:{ //lb
-					int64_t mem_value = mem_read(s, address, 1);
-					int8_t eight_bit_num = (mem_value << 56) >> 56;
-					rd = (int64_t) eight_bit_num;       
-                    break;
-				}
-                case 0x1:{ // lh
-					int64_t mem_value = mem_read(s, address, 2);
-                    int16_t sixteen_bit_num = (mem_value << 48) >> 48; 
-					rd = (int64_t) sixteen_bit_num;
-                    break;
-				}
-				case 0x2:{ // lw
-					int64_t mem_value = mem_read(s, address, 4);
-                    int32_t thirtytwo_bit_num = (mem_value << 32) >> 32; 
-					rd = (int64_t) thirtytwo_bit_num;
-                    break;
-				}
-				case 0x3:{ // ld
-					uint64_t mem_value = mem_read(s, address, 8);
-					rd = mem_value;
-					break;
-				}
-				case 0x4:{ // lbu
-					uint64_t unsigned_mem_value = mem_read(s, address, 1);
-					uint8_t eight_bit_num = (unsigned_mem_value << 56) >> 56;
-					rd = (int64_t) eight_bit_num;       
-                    break;
-				}
-				case 0x5: { // lhu
-					uint64_t unsigned_mem_value = mem_read(s, address, 2);
-					uint16_t sixteen_bit_num = (unsigned_mem_value << 48) >> 48;
-					rd = (int64_t) sixteen_bit_num;       
-                    break;
-				}					
-				case 0x6:{ // lwu
-					uint64_t unsigned_mem_value = mem_read(s, address, 4);
-                    uint32_t thirtytwo_bit_num = (unsigned_mem_value << 32) >> 32; 
-					rd = (int64_t) thirtytwo_bit_num;
-                    break;
-				}
-            }
-			
-            s->regs[rd_idx] = rd;
-            break;
-		}
-		case 0b0100011:{ // S format store instructions
-			ins = (int32_t) ins;
-            int funct3 = (ins >> 12) & 0b111,
-                rs1_idx = (ins >> 15) & 0b11111,
-				rs2_idx = (ins >> 20) & 0b11111,
-                imm = (ins>>7 & 0b11111) + ((ins>>25)<<5); // making sure that the sign remains.
-
-            int64_t rs1 = s->regs[rs1_idx], rs2 = s->regs[rs2_idx], rd;
-			int64_t address = rs1 + imm;
-            
-            switch(funct3) {
-                case 0x0: //sb
-					mem_write(s, address, rs2, 1);
-                    break;
-                case 0x1: // sh
-					mem_write(s, address, rs2, 2);
-                    break;
-				case 0x2: // sw
-					mem_write(s, address, rs2, 4);
-                    break;
-				case 0x3: // sd
-					mem_write(s, address, rs2, 8);
-					break;
-			}
-            break;
+// Reads memory for the instruction at `s->pc`. While fast-forwarding,
+// the hook and profiler are bypassed, and the cache is only peeked at,
+// since its dirty lines may be newer than memory.
+static inline uint64_t mem_load(Simulator *s, uint64_t addr, size_t num_bytes) {
+	if (!s->functional) {
+		if (s->mem_hook) s->mem_hook(s->mem_hook_data, s->pc, addr, num_bytes, 0);
+		if (s->cache_enabled) {
+			if (!s->profile) return cache_read(s->cache, s->pc, addr, num_bytes);
+			size_t misses = s->cache->misses;
+			uint64_t value = cache_read(s->cache, s->pc, addr, num_bytes);
+			profile_access(s, 0, s->cache->misses - misses);
+			return value;
 		}
-		case 0b1100011:{ // B format branch instructions
-			ins = (int32_t) ins;
-            int funct3 = (ins >> 12) & 0b111,
-                rs1_idx = (ins >> 15) & 0b11111,
-				rs2_idx = (ins >> 20) & 0b11111,
-                imm;
-			imm = ((ins>>31)<< 11) + // 12
-            	(((ins>>7)& 0b1) << 10) + // 11
-            	(((ins >>25) & 0b111111) << 4) + //10:5
-            	((ins>>8) & 0b1111); // 4:1
-			imm = imm << 1;
-			imm = imm | (0xffffe000 * (imm >> 12)); // sign extension to 32 bits
-            int64_t rs1 = s->regs[rs1_idx], rs2 = s->regs[rs2_idx], rd;
-			int64_t address = rs1 + imm;
-
-            switch(funct3) {
-                case 0x0:{ //beq
-					if (rs1 == rs2) s->pc += imm-4;
-                    break;
-				}
-                case 0x1:{ // bne
-					if (rs1 != rs2) s->pc += imm-4;
-                    break;
-				}
-				case 0x4: // blt
-					if (rs1 < rs2) s->pc += imm-4;
-                    break;
-				case 0x5: // bge
-					if (rs1 >= rs2) s->pc += imm-4;
-					break;
-				case 0x6: // bltu
-					if ((uint64_t)rs1 < (uint64_t)rs2) s->pc += imm-4;
-					break;
-				case 0x7: // bgeu
-					if ((uint64_t)rs1 >= (uint64_t)rs2) s->pc += imm-4;
-					break;
-			}
-            break;
-		}
-
-		case 0b0110111:{ // lui
-			int rd_idx = (ins >> 7) & 0b11111;
-			long int imm = (ins>>12);
+		if (s->profile) profile_access(s, 0, 0);
+	} else if (s->cache_enabled) {
+		return cache_peek(s->cache, addr, num_bytes);
+	}
 
+	uint64_t value = 0;
+	for (int i = 0; i < num_bytes; i++) {
+		value = (value << 8) + s->mem[addr + num_bytes - i - 1];
+	}
+	return value;
+}
 
-			int64_t rd = ((int64_t)imm << 44) >> 32; // we have to do msb extend
-			s->regs[rd_idx] = rd;
-			break;
+// Writes memory for the instruction at `s->pc`, like `mem_load`. While
+// fast-forwarding, cached copies are updated along with memory.
+static inline void mem_store(Simulator *s, uint64_t addr, uint64_t value, size_t num_bytes) {
+	if (!s->functional) {
+		if (s->mem_hook) s->mem_hook(s->mem_hook_data, s->pc, addr, num_bytes, 1);
+		if (s->cache_enabled) {
+			if (!s->profile) return cache_write(s->cache, s->pc, addr, value, num_bytes);
+			size_t misses = s->cache->misses;
+			cache_write(s->cache, s->pc, addr, value, num_bytes);
+			profile_access(s, 1, s->cache->misses - misses);
+			return;
 		}
-		case 0b0010111:{ //auipc
-			int rd_idx = (ins >> 7) & 0b11111,
-				imm = (ins>>12);
+		if (s->profile) profile_access(s, 1, 0);
+	} else if (s->cache_enabled) {
+		return cache_poke(s->cache, addr, value, num_bytes);
+	}
 
+	for (int i = 0; i < num_bytes; i++) {
+		s->mem[addr + i] = value & 0xff;
+		value = value >> 8;
+	}
+}
 
-			int64_t rd = (((int64_t)imm << 44) >> 32) + s->pc; // we have to do msb extend
-			s->regs[rd_idx] = rd;
-			break;
-		}
-		case 0b01101111:{ //jal
-			int rd_idx = (ins >> 7) & 0b11111,
-				imm;
-			imm = ((ins>>31)<< 19) + // 20
-            	(((ins>>12)& 0b11111111) << 11) + // 19:12
-            	(((ins >>20) & 0b1) << 10) + //11
-            	((ins>>21) & 0b1111111111); // 10:1
-			imm = imm <<1; // note that imm is a signed immediate
-
-			// Sign extension
-			imm = imm | 0xffe00000 * (imm >> 20);
-
-			int64_t rd = s->pc + 4;
-			s->pc += imm - 4;
-			s->regs[rd_idx] = rd;
-
-			char *label;
-			for (int i = 0; i < s->labels->len; i++) {
-				if (s->labels->data[i].offset == s->pc+4) {
-					label = s->labels->data[i].lbl_name;	
-				}
-			}
+// Returns whether an access may touch a watchpoint. An access can cross
+// into the next page, so the pages of its first and last bytes are both
+// checked.
+#define WATCH_PAGE(s, addr) ((s)->watch_pages[((addr) / WATCH_PAGE_SIZE) % WATCH_NUM_PAGES])
+#define WATCHED(s, addr, num_bytes) (WATCH_PAGE(s, addr) | WATCH_PAGE(s, (addr) + (num_bytes) - 1))
+
+// Raises an access fault for the instruction at `s->pc`, which ends the
+// program once the instruction retires. The access isn't made.
+static uint64_t mem_fault(Simulator *s, uint64_t addr) {
+	s->trap = TRAP_FAULT;
+	s->fault_addr = addr;
+	s->fault_pc = s->pc;
+	return 0;
+}
 
-			sim_stack_push(s, label, 0);
+uint64_t mem_read(Simulator *s, uint64_t addr, size_t num_bytes) {
+	if (addr > MEM_SIZE - num_bytes) return mem_fault(s, addr);
+	uint64_t value = mem_load(s, addr, num_bytes);
+	if (WATCHED(s, addr, num_bytes) && !s->functional && watch_match(s, addr, num_bytes, WATCH_READ)) {
+		s->watch_hit = (WatchHit){ 1, 0, s->pc, addr, value, value, num_bytes };
+	}
+	return value;
+}
 
-			break;
-		}
-		case 0b1100111:{ //jalr
-            int rd_idx = (ins >> 7) & 0b11111,
-                funct3 = (ins >> 12) & 0b111,
-                rs1_idx = (ins >> 15) & 0b11111,
-                imm = ins >> 20;
+void mem_write(Simulator *s, uint64_t addr, uint64_t value, size_t num_bytes) {
+	if (addr > MEM_SIZE - num_bytes) {
+		mem_fault(s, addr);
+		return;
+	}
+	if (WATCHED(s, addr, num_bytes) && !s->functional && watch_match(s, addr, num_bytes, WATCH_WRITE)) {
+		uint64_t old = mem_peek(s, addr, num_bytes);
+		mem_store(s, addr, value, num_bytes);
+		s->watch_hit = (WatchHit){ 1, 1, s->pc, addr, old, mem_peek(s, addr, num_bytes), num_bytes };
+		return;
+	}
+	mem_store(s, addr, value, num_bytes);
+}
 
-            int64_t rs1 = s->regs[rs1_idx], rd;
+// Reads memory as the program sees it, which may be in the cache,
+// without counting an access
+uint64_t mem_peek(Simulator *s, uint64_t addr, size_t num_bytes) {
+	if (s->cache_enabled) return cache_peek(s->cache, addr, num_bytes);
+	uint64_t value = 0;
+	for (int i = num_bytes - 1; i >= 0; i--) value = (value << 8) + s->mem[addr + i];
+	return value;
+}
 
-			rd = s->pc + 4;
-			s->pc = rs1 + imm - 4; // return address + immediate;
+// Writes memory and any cached copies without counting an access
+void mem_poke(Simulator *s, uint64_t addr, uint64_t value, size_t num_bytes) {
+	if (s->cache_enabled) {
+		cache_poke(s->cache, addr, value, num_bytes);
+		return;
+	}
+	for (int i = 0; i < num_bytes; i++) {
+		s->mem[addr + i] = value & 0xff;
+		value >>= 8;
+	}
+}
 
-			s->regs[rd_idx] = rd;
-			
-			sim_stack_pop(s);
-			
-			break;
-		}
-    }
-	
-	// Force x0 to 0
-	s->regs[0] = 0;
-    s->pc += 4;
+// Returns the decoded instruction at `pc`. Instructions outside the
+// text segment are decoded on the fly.
+DecodedIns *sim_decoded_at(Simulator *s, uint64_t pc) {
+	if (pc < s->text_end && pc % 4 == 0) {
+		return &s->decoded[pc / 4];
+	}
+	decode_ins(*(uint32_t*)(&s->mem[pc]), &s->scratch);
+	return &s->scratch;
+}
+
+// Executes a single instruction
+void sim_run_one(Simulator *s) {
+	exec_ins(s, sim_decoded_at(s, s->pc));
 }
 
 // Prints the values of rhe registers
@@ -581,70 +585,239 @@ void sim_mem(Simulator *s, int start, int count){
 	}
 }
 
-// Get the line number of the nth instruction
-int get_ins_line(Simulator *s, int n) {
-	ParseNode *p = s->nodes;
-	int i = 0;
-	while (i < n) {
-		if (p->type == LABEL) {p++; continue;}
-		i++;
-		p++;	
+// Get the line number of the instruction at `pc`
+int get_ins_line(Simulator *s, uint64_t pc) {
+	if (pc >= s->text_end) return 0;
+	return s->ins_lines[pc / 4];
+}
+
+// Prints an executed instruction and records its line in the call stack.
+// `len` is the length of the stack before the instruction executed.
+// Nothing is printed in quiet mode.
+void sim_retire(Simulator *s, uint64_t pc, size_t len) {
+	int line = get_ins_line(s, pc);
+	if (!s->quiet) {
+		printf("Executed: ");
+		print_line(s->src, line);
+		printf("; PC = 0x%08lx\n", pc);
 	}
-	return (--p)->line;
 
+	// Update call stack
+	s->stack->data[len-1].line = line;
+	s->retired++;
+	if (s->profile) profile_retire(s, pc);
+}
+
+// Returns the instruction at the PC, which is 0 where the program ends.
+// Execution ends by falling off the text segment onto a zero word; any
+// other PC outside the text segment raises a fetch fault and returns 0.
+static inline uint32_t sim_fetch(Simulator *s) {
+	if (s->pc < s->text_end && s->pc % 4 == 0) return *(uint32_t*)(&s->mem[s->pc]);
+	if (s->pc % 4 == 0 && s->pc <= MEM_SIZE - 4 && !*(uint32_t*)(&s->mem[s->pc])) return 0;
+	s->trap = TRAP_FETCH;
+	return 0;
 }
 
 // Executes one instruction
 void sim_step(Simulator *s) {
-	uint32_t ins = *(uint32_t*)(&s->mem[s->pc]);
-	if (!ins) {
-		printf("Nothing to step\n");
+	// A program ended by a trap stops on a non-zero instruction
+	if (!s->execution_in_progress || !sim_fetch(s)) {
+		if (s->trap) {
+			sim_trap(s);
+			printf("%s", s->error);
+		} else {
+			printf("Nothing to step\n");
+		}
 		return;
-	};
+	}
 	
 	uint64_t pc = s->pc;
 	int len = s->stack->len;
+	if (s->undo) undo_record(s, sim_decoded_at(s, pc));
 	sim_run_one(s);
-	
-	printf("Executed: ");
-	int line = get_ins_line(s, pc/4+1);
-	print_line(s->src, line);
-	printf("; PC = 0x%08lx\n", pc);
-
-	// Update call stack
-	s->stack->data[len-1].line = line;
+	sim_retire(s, pc, len);
+	watch_report(s);
+	if (s->trap && sim_trap(s) == STOP_END) {
+		if (s->error) printf("%s", s->error);
+		return;
+	}
 
 	// Remove `main` from stack at end of code
-	ins = *(uint32_t*)(&s->mem[s->pc]);
-	if (!ins) {
+	if (!sim_fetch(s)) {
+		if (s->trap) {
+			sim_trap(s);
+			printf("%s", s->error);
+			return;
+		}
 		s->execution_in_progress = 0;
 		s->stack->len--;
 	}
 }
 
-// Executes instructions intil EOF or until breakpoint
-void sim_run(Simulator *s) {
-    uint32_t ins = *(uint32_t*)(&s->mem[s->pc]);
+// Executes at most `max` instructions, stopping early at the end of the
+// program or at a breakpoint. Instructions are dispatched through their
+// pre-decoded handlers, so fused pairs run in a single dispatch.
+StopReason sim_run_for(Simulator *s, uint64_t max) {
+	if (!s->execution_in_progress) return STOP_END;
+	if (!sim_fetch(s)) return s->trap? sim_trap(s): STOP_END;
+
+	uint64_t limit = (max > UINT64_MAX - s->retired)? UINT64_MAX: s->retired + max;
+	while (s->retired < limit) {
+		uint64_t pc = s->pc;
+		int len = s->stack->len;
+		DecodedIns *d = sim_decoded_at(s, pc);
+		if (s->pair_counts && d != &s->scratch) fusion_count(s, d);
+		if (s->undo) undo_record(s, d);
+
+		// Split a fused pair that would run past the limit
+		if (d->fused && s->retired + 1 == limit) {
+			exec_ins(s, d);
+			sim_retire(s, pc, len);
+		} else {
+			d->fn(s, d);
+			sim_retire(s, pc, len);
+			if (d->fused) sim_retire(s, pc + 4, len);
+		}
+		if (s->trap) return sim_trap(s);
+
+		// Remove `main` from stack at end of code
+		if (!sim_fetch(s)) {
+			if (s->trap) return sim_trap(s);
+			s->stack->len--;
+			s->execution_in_progress = 0;
+			return STOP_END;
+		}
 
-	while (ins) {
-		sim_step(s);
-		ins = *(uint32_t*)(&s->mem[s->pc]);
-		if (!ins) break;
+		if (s->watch_hit.hit) return STOP_WATCHPOINT;
 
 		// Check if current line is a breakpoint
-		int line = get_ins_line(s, s->pc/4+1);
-		for (int i = 0; i < s->breaks->len; i++) {
-			if (s->breaks->data[i] == line) {
-				printf("Execution stopped at breakpoint\n");
-				return;
+		if (s->pc < s->text_end && s->bp_at[s->pc / 4]) {
+			return STOP_BREAKPOINT;
+		}
+	}
+
+	return STOP_LIMIT;
+}
+
+// Handles the trap raised by the instruction that just retired, or by
+// fetching the next one. `ebreak` stops like a breakpoint. An exit call
+// ends the program, and so do other system calls, illegal instructions
+// and faults, which leave their error in `s->error`.
+StopReason sim_trap(Simulator *s) {
+	Trap trap = s->trap;
+	s->trap = TRAP_NONE;
+	if (trap == TRAP_BREAK) {
+		if (sim_fetch(s)) return STOP_BREAKPOINT;
+		trap = s->trap;
+		s->trap = TRAP_NONE;
+	}
+
+	char msg[100];
+	free(s->error);
+	s->error = NULL;
+	if (trap == TRAP_SYSCALL) {
+		snprintf(msg, sizeof(msg), "Error: Unsupported system call %lu at PC 0x%08lx\n", s->regs[17], s->pc);
+		s->error = strdup(msg);
+	} else if (trap == TRAP_ILLEGAL) {
+		snprintf(msg, sizeof(msg), "Error: Illegal instruction 0x%08x at PC 0x%08lx\n",
+			*(uint32_t*)(&s->mem[s->pc]), s->pc);
+		s->error = strdup(msg);
+	} else if (trap == TRAP_FAULT) {
+		s->pc = s->fault_pc;
+		snprintf(msg, sizeof(msg), "Error: Access fault at address 0x%lx from PC 0x%08lx\n", s->fault_addr, s->pc);
+		s->error = strdup(msg);
+	} else if (trap == TRAP_FETCH) {
+		snprintf(msg, sizeof(msg), "Error: Instruction fetch fault at PC 0x%08lx\n", s->pc);
+		s->error = strdup(msg);
+	}
+
+	s->stack->len--;
+	s->execution_in_progress = 0;
+	return STOP_END;
+}
+
+// Executes at most `max` instructions functionally: the cache's
+// statistics and replacement state, memory hook and profiler are
+// bypassed, nothing is printed, breakpoints are
+// ignored and the call stack isn't tracked.
+StopReason sim_fast_forward(Simulator *s, uint64_t max) {
+	if (!s->execution_in_progress) return STOP_END;
+	if (!sim_fetch(s)) return s->trap? sim_trap(s): STOP_END;
+
+	uint64_t limit = (max > UINT64_MAX - s->retired)? UINT64_MAX: s->retired + max;
+	StopReason reason = STOP_LIMIT;
+	s->functional = 1;
+	while (s->retired < limit) {
+		DecodedIns *d = sim_decoded_at(s, s->pc);
+		int n = (d->fused && s->retired + 1 == limit)? 1: 1 + d->fused;
+		if (s->ins_counts && d != &s->scratch) {
+			s->ins_counts[d - s->decoded]++;
+			if (n == 2) s->ins_counts[d - s->decoded + 1]++;
+		}
+
+		if (n == 1) {
+			exec_ins(s, d);
+		} else {
+			d->fn(s, d);
+		}
+		s->retired += n;
+
+		// `ebreak` doesn't stop fast-forwarding
+		if (s->trap && sim_trap(s) == STOP_END) {
+			reason = STOP_END;
+			break;
+		}
+
+		if (!sim_fetch(s)) {
+			if (s->trap) {
+				sim_trap(s);
+			} else {
+				s->stack->len--;
+				s->execution_in_progress = 0;
 			}
+			reason = STOP_END;
+			break;
 		}
 	}
+	s->functional = 0;
+	return reason;
+}
 
-	if (!ins) s->execution_in_progress = 0;
-	if (s->cache_enabled) print_cache_stats(s->cache);
+// Executes instructions intil EOF or until breakpoint
+void sim_run(Simulator *s) {
+	int running = s->execution_in_progress;
+	StopReason reason = sim_run_for(s, UINT64_MAX);
+	watch_report(s);
+	if (reason == STOP_END && running && s->error) printf("%s", s->error);
+	if (reason == STOP_BREAKPOINT) {
+		printf("Execution stopped at breakpoint\n");
+		return;
+	}
+	if (reason == STOP_WATCHPOINT) {
+		printf("Execution stopped at watchpoint\n");
+		return;
+	}
+
+	if (s->cache_enabled && !s->quiet) print_cache_stats(s->cache);
+	if (s->profile) profile_report(s);
 } 
 
+// Marks the instructions that lie on breakpoint lines and refuses
+// instruction pairs around them
+void sim_update_breakpoints(Simulator *s) {
+	if (!s->decoded) return;
+
+	for (size_t i = 0; i < s->num_ins; i++) {
+		s->bp_at[i] = 0;
+		for (int j = 0; j < s->breaks->len; j++) {
+			if (s->breaks->data[j] == s->ins_lines[i]) {
+				s->bp_at[i] = 1;
+			}
+		}
+	}
+	sim_fuse(s);
+}
+
 // Adds a breakpoint
 void sim_add_breakpoint(Simulator *s, int line) {
 	// If there is no space, then grow the breakpoint array
@@ -653,6 +826,7 @@ void sim_add_breakpoint(Simulator *s, int line) {
 		s->breaks->cap += 1024;
 	}
 	s->breaks->data[s->breaks->len++] = line;
+	sim_update_breakpoints(s);
 	printf("Breakpoint set at line %d\n", line);
 }
 
@@ -667,6 +841,7 @@ void sim_remove_breakpoint(Simulator *s, int line) {
 	}
 	if (found) {
 		s->breaks->data[idx] = s->breaks->data[--s->breaks->len];
+		sim_update_breakpoints(s);
 		printf("Deleted breakpoint at line %d\n", line);
 	} else {
 		printf("No breakpoint at line %d\n", line);
@@ -685,9 +860,70 @@ void sim_stack_push(Simulator *s, char *label, int line) {
 	s->stack->len++;
 }
 
-// Pops one entry from the top of the stack
+// Pops one entry from the top of the stack. The bottom entry is kept,
+// since calls made while fast-forwarding aren't on the stack.
 void sim_stack_pop(Simulator *s) {
-	s->stack->len--;
+	if (s->stack->len > 1) s->stack->len--;
+}
+
+// Prints the number of executed instructions and the cache statistics
+void sim_stats(Simulator *s) {
+	printf("Instructions executed: %lu\n", s->retired);
+	if (s->cache_enabled) print_cache_stats(s->cache);
+}
+
+// Orders instruction counters by misses, then by hits, descending. Ties
+// are broken by address so the report is stable.
+static int counters_cmp(const void *a, const void *b) {
+	CacheCounters *x = *(CacheCounters**)a, *y = *(CacheCounters**)b;
+	if (x->misses != y->misses) return (x->misses < y->misses)? 1: -1;
+	if (x->hits != y->hits) return (x->hits < y->hits)? 1: -1;
+	return (x < y)? -1: 1;
+}
+
+// Prints the cache statistics of every instruction that accessed memory,
+// ranked by misses, followed by the statistics of each memory region
+void sim_cache_stats_by_pc(Simulator *s) {
+	Cache *c = s->cache;
+	print_cache_stats(c);
+
+	CacheCounters **order = malloc(c->num_pcs * sizeof(CacheCounters*));
+	size_t n = 0;
+	for (size_t i = 0; i < c->num_pcs; i++) {
+		if (c->pc_counters[i].hits || c->pc_counters[i].misses) order[n++] = &c->pc_counters[i];
+	}
+	qsort(order, n, sizeof(CacheCounters*), counters_cmp);
+
+	printf("\n%-10s %6s %10s %10s %10s %9s  %s\n",
+		"PC", "Line", "Hits", "Misses", "Writebacks", "Miss Rate", "Source");
+	for (size_t i = 0; i < n; i++) {
+		CacheCounters *e = order[i];
+		size_t ins = e - c->pc_counters;
+		printf("0x%08lx %6d %10lu %10lu %10lu %9.2lf  ", 4 * ins, s->ins_lines[ins],
+			e->hits, e->misses, e->writebacks, (double)e->misses / (e->hits + e->misses));
+		print_line(s->src, s->ins_lines[ins]);
+		printf("\n");
+	}
+	free(order);
+
+	CacheCounters *e = &c->unattributed_pc;
+	if (e->hits || e->misses || e->writebacks) {
+		printf("%-17s %10lu %10lu %10lu\n", "Unattributed", e->hits, e->misses, e->writebacks);
+	}
+
+	printf("\n%-23s %10s %10s %10s %9s\n", "Region", "Hits", "Misses", "Writebacks", "Miss Rate");
+	for (size_t i = 0; i < c->num_regions; i++) {
+		CacheCounters *e = &c->region_counters[i];
+		if (!e->hits && !e->misses && !e->writebacks) continue;
+		double miss_rate = (e->hits + e->misses)? (double)e->misses / (e->hits + e->misses): 0;
+		printf("0x%08lx-0x%08lx  %10lu %10lu %10lu %9.2lf\n", i * CACHE_REGION_SIZE,
+			(i + 1) * CACHE_REGION_SIZE - 1, e->hits, e->misses, e->writebacks, miss_rate);
+	}
+
+	e = &c->unattributed_region;
+	if (e->hits || e->misses || e->writebacks) {
+		printf("%-23s %10lu %10lu %10lu\n", "Unattributed", e->hits, e->misses, e->writebacks);
+	}
 }
 
 // Shows the stack
@@ -4,11 +4,40 @@
 #include "asm/emitter.h"
 #endif
 
+#ifndef PARALLEL_H
+#include "asm/parallel.h"
+#endif
+
 #ifndef CACHE_H
 #include "cache.h"
 #endif
 
+#ifndef DECODER_H
+#include "decoder.h"
+#endif
+
+#ifndef PROFILE_H
+#include "profile.h"
+#endif
+
+#ifndef UNDO_H
+#include "undo.h"
+#endif
+
+#ifndef WATCH_H
+#include "watch.h"
+#endif
+
+#ifndef IMAGE_H
+#include "image.h"
+#endif
+
+#ifndef ELF_LOADER_H
+#include "elf_loader.h"
+#endif
+
 #define MEM_SIZE 0x50001
+#define DATA_SEGMENT_START 0x10000
 
 typedef struct StackEntry {
     char *label;
@@ -25,29 +54,104 @@ typedef struct BreakPointVec {
     int *data;
 } BreakPointVec;
 
+// Called for every memory access with the PC of the accessing instruction
+typedef void (*MemHook)(void *data, uint64_t pc, uint64_t addr, size_t num_bytes, int is_write);
+
+// Raised by an instruction and handled by `sim_trap` once it retires
+typedef enum Trap {
+    TRAP_NONE, TRAP_EXIT, TRAP_BREAK, TRAP_SYSCALL, TRAP_ILLEGAL,
+    TRAP_FAULT, // A load or store outside memory
+    TRAP_FETCH  // A PC outside the text segment
+} Trap;
+
+// System call numbers (in a7) of the RISC-V Linux ABI
+#define SYS_EXIT 93
+#define SYS_EXIT_GROUP 94
+
+// Why `sim_run_for` returned
+typedef enum StopReason {
+    STOP_END, STOP_BREAKPOINT, STOP_LIMIT, STOP_WATCHPOINT
+} StopReason;
+
 typedef struct Simulator {
     uint64_t pc, regs[32];    
     uint8_t mem[MEM_SIZE];
     char *src; 
+    size_t src_len;
+    int src_mapped;    // `src` is a mapping of the source file, not a heap buffer
     ParseNode *nodes;
+    Arena arena;       // Owns the nodes, labels and messages of the loaded program
+    size_t num_nodes;
     LabelVec *labels;
     BreakPointVec *breaks;
+    WatchVec *watches;
+    uint8_t watch_pages[WATCH_NUM_PAGES]; // Pages with watchpoints
+    WatchHit watch_hit;
     StackVec *stack;
 
+    // Pre-decoded text segment, one entry per instruction
+    DecodedIns *decoded, scratch;
+    int *ins_lines;    // Source line of each instruction
+    uint8_t *bp_at;    // Marks instructions on a breakpoint line
+    size_t num_ins;
+    uint64_t text_end;
+    size_t data_len;   // Bytes of the data segment filled by the program
+    int elf;           // The program was loaded from an ELF executable
+    uint64_t *pair_counts; // Executed instruction pairs, used to build the fusion table
+    ProfileEntry *profile; // Per-instruction counters, NULL unless profiling
+    int profiling;         // Allocates `profile` for every loaded program
+
+    uint64_t retired;  // Number of instructions executed since load
+    int quiet;         // Suppresses per-instruction output
+    int one_pass;      // Assembles with `assemble` instead of separate passes
+    int asm_threads;   // Threads for parsing and encoding large sources
+    int functional;    // Set while fast-forwarding, see `sim_fast_forward`
+    uint64_t *ins_counts; // Executions of each instruction while fast-forwarding, if not NULL
+    UndoLog *undo;     // Recent instructions for reverse execution, NULL if disabled
+
+    char *error;       // Message from the last failed load, or from the trap that ended the program
+    Trap trap;         // Raised by the last instruction, TRAP_NONE otherwise
+    uint64_t fault_addr, fault_pc; // Address and instruction of the last TRAP_FAULT
+
+    MemHook mem_hook;
+    void *mem_hook_data;
+
     int execution_in_progress;
     int cache_enabled;
+    int seeded;        // Overrides the config's RANDOM seed with `seed`
+    uint64_t seed;
+    char *log_file;    // Path of the cache log, derived from the program if NULL
+    int log_disabled;
+    char *asm_cache;   // Directory of cached program images, or NULL
     CacheConfig cache_cfg;
     Cache *cache;
 } Simulator;
 
 void sim_init(Simulator *s);
 int sim_load(Simulator *s, char *file);
+int sim_load_image(Simulator *s, char *file);
+int sim_load_source(Simulator *s, char *src, size_t len, int mapped);
+void sim_load_finish(Simulator *s);
 void sim_uninit(Simulator *s);
 void sim_run_one(Simulator *s);
 void sim_step(Simulator *s);
 void sim_run(Simulator *s);
+StopReason sim_run_for(Simulator *s, uint64_t max);
+StopReason sim_fast_forward(Simulator *s, uint64_t max);
+StopReason sim_trap(Simulator *s);
 void sim_regs(Simulator *s);
 void sim_mem(Simulator *s, int start, int count);
 void sim_add_breakpoint(Simulator *s, int line);
 void sim_remove_breakpoint(Simulator *s, int line);
-void sim_show_stack(Simulator *s);
\ No newline at end of file
+void sim_update_breakpoints(Simulator *s);
+void sim_show_stack(Simulator *s);
+void sim_stats(Simulator *s);
+void sim_cache_stats_by_pc(Simulator *s);
+void print_line(char *src, int line);
+int get_ins_line(Simulator *s, uint64_t pc);
+void sim_stack_push(Simulator *s, char *label, int line);
+void sim_stack_pop(Simulator *s);
+uint64_t mem_read(Simulator *s, uint64_t addr, size_t num_bytes);
+void mem_write(Simulator *s, uint64_t addr, uint64_t value, size_t num_bytes);
+uint64_t mem_peek(Simulator *s, uint64_t addr, size_t num_bytes);
+void mem_poke(Simulator *s, uint64_t addr, uint64_t value, size_t num_bytes);
\ No newline at end of file
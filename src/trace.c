@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef TRACE_H
+#include "trace.h"
+#endif
+
+#ifndef SIMULATOR_H
+#include "simulator.h"
+#endif
+
+/*
+   Memory access traces. A trace starts with TRACE_MAGIC and holds one
+   record per access:
+
+     flags      1 byte: bit 0 is set for writes, bits 1-2 are log2(size)
+     pc delta   zigzag varint, relative to the previous record
+     addr delta zigzag varint, relative to the previous record
+
+   Consecutive accesses are usually close together, so most records
+   take three or four bytes.
+*/
+
+// Writes the buffered records to the file
+static void trace_flush(TraceWriter *w) {
+    fwrite(w->buf, 1, w->len, w->f);
+    w->len = 0;
+}
+
+static inline void put_varint(TraceWriter *w, int64_t delta) {
+    uint64_t v = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+    while (v >= 0x80) {
+        w->buf[w->len++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    w->buf[w->len++] = v;
+}
+
+// Returns 0 if the varint runs past the end of the trace
+static inline int get_varint(TraceReader *r, int64_t *delta) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (r->ptr == r->end) return 0;
+        uint8_t b = *r->ptr++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *delta = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Creates a trace file. Returns NULL if it can't be opened.
+TraceWriter *trace_create(char *filename) {
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        printf("Could not open trace file\n");
+        return NULL;
+    }
+
+    TraceWriter *w = calloc(1, sizeof(TraceWriter));
+    w->f = f;
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), f);
+    return w;
+}
+
+// Appends an access to the trace. The signature matches `MemHook`, so
+// the writer can be installed as the simulator's memory hook.
+void trace_record(void *writer, uint64_t pc, uint64_t addr, size_t num_bytes, int is_write) {
+    TraceWriter *w = writer;
+
+    // A record is at most 1 + 2 * 10 bytes
+    if (w->len + 21 > TRACE_BUF_SIZE) trace_flush(w);
+
+    uint8_t size_log2 = (num_bytes == 8)? 3: (num_bytes == 4)? 2: (num_bytes == 2)? 1: 0;
+    w->buf[w->len++] = (size_log2 << 1) | (is_write? 1: 0);
+    put_varint(w, pc - w->pc);
+    put_varint(w, addr - w->addr);
+    w->pc = pc;
+    w->addr = addr;
+    w->count++;
+}
+
+// Flushes and closes a trace. Returns -1 if anything couldn't be written.
+int trace_finish(TraceWriter *w) {
+    trace_flush(w);
+    int status = (ferror(w->f) || fclose(w->f) != 0)? -1: 0;
+    if (status) printf("Could not write trace file\n");
+    free(w);
+    return status;
+}
+
+// Runs the loaded program like `sim_run`, recording its memory accesses
+// to `trace_file`
+int sim_run_traced(Simulator *s, char *trace_file) {
+    TraceWriter *w = trace_create(trace_file);
+    if (!w) return -1;
+
+    MemHook hook = s->mem_hook;
+    void *data = s->mem_hook_data;
+    s->mem_hook = trace_record;
+    s->mem_hook_data = w;
+    sim_run(s);
+    s->mem_hook = hook;
+    s->mem_hook_data = data;
+
+    uint64_t count = w->count;
+    if (trace_finish(w) != 0) return -1;
+    if (!s->quiet) printf("Recorded %lu accesses to %s\n", count, trace_file);
+    return 0;
+}
+
+// Maps a trace file into memory and checks its header
+int trace_open(TraceReader *r, char *filename) {
+    memset(r, 0, sizeof(TraceReader));
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Could not open trace file\n");
+        return -1;
+    }
+
+    struct stat st;
+    size_t magic_len = strlen(TRACE_MAGIC);
+    if (fstat(fd, &st) != 0 || st.st_size < magic_len) {
+        printf("Invalid trace file\n");
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Could not map trace file\n");
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    r->map = map;
+    r->map_len = st.st_size;
+    r->end = r->map + r->map_len;
+    if (memcmp(r->map, TRACE_MAGIC, magic_len) != 0) {
+        printf("Invalid trace file\n");
+        trace_close(r);
+        return -1;
+    }
+    r->ptr = r->map + magic_len;
+    return 0;
+}
+
+// Reads the next record. Returns 1 on success, 0 at the end of the trace
+// and -1 if the trace is truncated or describes an access outside memory.
+int trace_next(TraceReader *r, TraceRecord *rec) {
+    if (r->ptr == r->end) return 0;
+
+    uint8_t flags = *r->ptr++;
+    int64_t pc_delta, addr_delta;
+    if (flags > 7 || !get_varint(r, &pc_delta) || !get_varint(r, &addr_delta)) return -1;
+
+    r->pc += pc_delta;
+    r->addr += addr_delta;
+    rec->pc = r->pc;
+    rec->addr = r->addr;
+    rec->size = 1 << (flags >> 1);
+    rec->is_write = flags & 1;
+    if (rec->addr >= MEM_SIZE || rec->size > MEM_SIZE - rec->addr) return -1;
+    return 1;
+}
+
+void trace_close(TraceReader *r) {
+    if (r->map) munmap((void*)r->map, r->map_len);
+    r->map = r->ptr = r->end = NULL;
+}
+
+// Replays the accesses of one shard of a trace. Sets are independent,
+// so a shard made of whole sets can be simulated on its own cache. Each
+// shard has its own copy of memory for block fills and writebacks.
+//
+// A serial replay reads the trace as it goes. For a parallel replay, the
+// trace is decoded once up front and each shard is given the records of
+// its own sets.
+typedef struct ReplayShard {
+    pthread_t thread;
+    TraceReader r;       // Trace of a serial replay, unmapped otherwise
+    TraceRecord *recs;   // Records of a shard replayed in parallel
+    size_t num_recs, cap;
+    CacheConfig *cfg;
+    FILE *log;
+    char *log_buf;   // Log of a shard replayed in parallel
+    size_t log_len;
+    CacheCounters totals;
+    int status;
+} ReplayShard;
+
+// Returns the shard that simulates the set of `addr`
+static inline int replay_shard_of(Cache *c, uint64_t addr, int num_shards) {
+    return (addr / c->block_size) % c->num_lines % num_shards;
+}
+
+// Runs one access through a shard's cache
+static inline void replay_access(Cache *c, TraceRecord *rec) {
+    if (rec->is_write) {
+        cache_write(c, rec->pc, rec->addr, 0, rec->size);
+    } else {
+        cache_read(c, rec->pc, rec->addr, rec->size);
+    }
+}
+
+static void *replay_worker(void *arg) {
+    ReplayShard *sh = arg;
+    Cache c;
+    cache_init(&c, sh->cfg);
+    c.mem = calloc(MEM_SIZE, sizeof(uint8_t));
+    c.output_file = sh->log;
+
+    if (sh->r.map) {
+        TraceRecord rec;
+        while ((sh->status = trace_next(&sh->r, &rec)) == 1) replay_access(&c, &rec);
+    } else {
+        for (size_t i = 0; i < sh->num_recs; i++) replay_access(&c, &sh->recs[i]);
+    }
+    sh->totals = (CacheCounters){ c.hits, c.misses, c.writebacks };
+
+    free(c.mem);
+    cache_free(&c);
+    return NULL;
+}
+
+// Decodes a whole trace and appends each record to the shard of its set.
+// If `order` is not NULL, it receives the shard of every record that
+// logs a line, in the order of the trace, and `num_order` their number.
+// Returns 0 on success and -1 if the trace is invalid; the records before
+// the invalid one are still given to their shards.
+static int replay_partition(TraceReader *r, Cache *c, ReplayShard *shards, int num_shards,
+                            int **order, size_t *num_order) {
+    size_t cap = 0;
+    TraceRecord rec;
+    int status;
+    while ((status = trace_next(r, &rec)) == 1) {
+        int i = replay_shard_of(c, rec.addr, num_shards);
+        ReplayShard *sh = &shards[i];
+        if (sh->num_recs == sh->cap) {
+            sh->cap = sh->cap? 2 * sh->cap: 1024;
+            sh->recs = realloc(sh->recs, sh->cap * sizeof(TraceRecord));
+        }
+        sh->recs[sh->num_recs++] = rec;
+
+        // Multi-block accesses bypass the cache and don't log a line
+        if (!order || rec.addr % c->block_size + rec.size > c->block_size) continue;
+        if (*num_order == cap) {
+            cap = cap? 2 * cap: 1024;
+            *order = realloc(*order, cap * sizeof(int));
+        }
+        (*order)[(*num_order)++] = i;
+    }
+    return status;
+}
+
+// Writes the logs of parallel shards to `f` in the order of the accesses
+// in the trace, given by the shard of each line in `order`
+static void replay_merge_logs(ReplayShard *shards, int num_shards, int *order, size_t num_order, FILE *f) {
+    char **pos = malloc(num_shards * sizeof(char*));
+    for (int i = 0; i < num_shards; i++) pos[i] = shards[i].log_buf;
+
+    for (size_t n = 0; n < num_order; n++) {
+        int i = order[n];
+        char *end = memchr(pos[i], '\n', shards[i].log_buf + shards[i].log_len - pos[i]);
+        if (!end) break;
+        fwrite(pos[i], 1, end + 1 - pos[i], f);
+        pos[i] = end + 1;
+    }
+    free(pos);
+}
+
+// Runs the accesses of a trace through a cache built from `cfg`, without
+// executing any instructions. The cache log goes to `log_file` if it is
+// not NULL. Prints the cache statistics and stores the totals in
+// `totals`.
+//
+// The sets are split between `num_threads` threads. The totals and the
+// log are the same as for a serial replay. RANDOM replacement draws from
+// one generator for all sets, so it is always replayed serially.
+int trace_replay(char *trace_file, CacheConfig *cfg, char *log_file, int num_threads, CacheCounters *totals) {
+    TraceReader r;
+    if (trace_open(&r, trace_file) != 0) return -1;
+
+    // The geometry decides the shard of each access
+    Cache geometry;
+    cache_init(&geometry, cfg);
+    if (cfg->replacement_policy == RANDOM || num_threads < 1) num_threads = 1;
+    if (num_threads > geometry.num_lines) num_threads = geometry.num_lines;
+
+    FILE *log = NULL;
+    if (log_file && !(log = fopen(log_file, "w"))) {
+        printf("Could not open log file\n");
+    }
+
+    ReplayShard *shards = calloc(num_threads, sizeof(ReplayShard));
+    for (int i = 0; i < num_threads; i++) {
+        shards[i].cfg = cfg;
+        if (log && num_threads == 1) {
+            shards[i].log = log;
+        } else if (log) {
+            shards[i].log = open_memstream(&shards[i].log_buf, &shards[i].log_len);
+        }
+    }
+
+    int *order = NULL;
+    size_t num_order = 0;
+    if (num_threads == 1) {
+        shards[0].r = r;
+        replay_worker(&shards[0]);
+    } else {
+        shards[0].status = replay_partition(&r, &geometry, shards, num_threads, log? &order: NULL, &num_order);
+        for (int i = 0; i < num_threads; i++) {
+            pthread_create(&shards[i].thread, NULL, replay_worker, &shards[i]);
+        }
+        for (int i = 0; i < num_threads; i++) {
+            pthread_join(shards[i].thread, NULL);
+        }
+    }
+
+    int status = 0;
+    Cache total = {0};
+    for (int i = 0; i < num_threads; i++) {
+        if (shards[i].status < 0) status = -1;
+        total.hits += shards[i].totals.hits;
+        total.misses += shards[i].totals.misses;
+        total.writebacks += shards[i].totals.writebacks;
+        if (num_threads > 1 && shards[i].log) fclose(shards[i].log);
+    }
+    if (status < 0) printf("Invalid trace file\n");
+
+    if (log && num_threads > 1) replay_merge_logs(shards, num_threads, order, num_order, log);
+    if (log) fclose(log);
+
+    print_cache_stats(&total);
+    *totals = (CacheCounters){ total.hits, total.misses, total.writebacks };
+
+    for (int i = 0; i < num_threads; i++) {
+        free(shards[i].log_buf);
+        free(shards[i].recs);
+    }
+    free(shards);
+    free(order);
+    cache_free(&geometry);
+    trace_close(&r);
+    return status;
+}
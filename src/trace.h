@@ -0,0 +1,48 @@
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+struct Simulator;
+
+#ifndef CACHE_H
+#include "cache.h"
+#endif
+
+// Magic bytes at the start of every trace file
+#define TRACE_MAGIC "RVTRACE1"
+#define TRACE_BUF_SIZE 65536
+
+// One memory access from a trace
+typedef struct TraceRecord {
+    uint64_t pc, addr;
+    uint8_t size, is_write;
+} TraceRecord;
+
+// Writes accesses to a trace file. Each record is a flags byte followed
+// by the PC and address as zigzag varint deltas from the previous record.
+typedef struct TraceWriter {
+    FILE *f;
+    uint64_t pc, addr, count;
+    size_t len;
+    uint8_t buf[TRACE_BUF_SIZE];
+} TraceWriter;
+
+// Reads records from a memory-mapped trace file
+typedef struct TraceReader {
+    const uint8_t *map, *ptr, *end;
+    size_t map_len;
+    uint64_t pc, addr;
+} TraceReader;
+
+TraceWriter *trace_create(char *filename);
+void trace_record(void *writer, uint64_t pc, uint64_t addr, size_t num_bytes, int is_write);
+int trace_finish(TraceWriter *w);
+int sim_run_traced(struct Simulator *s, char *trace_file);
+
+int trace_open(TraceReader *r, char *filename);
+int trace_next(TraceReader *r, TraceRecord *rec);
+void trace_close(TraceReader *r);
+
+int trace_replay(char *trace_file, CacheConfig *cfg, char *log_file, int num_threads, CacheCounters *totals);
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef UNDO_H
+#include "undo.h"
+#endif
+
+#ifndef SIMULATOR_H
+#include "simulator.h"
+#endif
+
+/*
+   Reverse execution. Before each instruction runs, the state it is
+   about to change is saved in the undo log: the PC, the destination
+   register or the bytes overwritten by a store, and the top of the call
+   stack. Stepping back restores the newest entry. The cache isn't
+   rolled back; its contents and statistics keep the accesses of the
+   undone instructions.
+*/
+
+// Starts recording, keeping up to `entries` instructions. Fusion is
+// disabled while recording so that each entry covers one instruction.
+void undo_enable(Simulator *s, size_t entries) {
+    undo_disable(s);
+    s->undo = malloc(sizeof(UndoLog));
+    s->undo->entries = malloc(entries * sizeof(UndoEntry));
+    s->undo->cap = entries;
+    undo_reset(s);
+    if (s->decoded) sim_fuse(s);
+}
+
+void undo_disable(Simulator *s) {
+    if (!s->undo) return;
+    free(s->undo->entries);
+    free(s->undo);
+    s->undo = NULL;
+    if (s->decoded) sim_fuse(s);
+}
+
+// Empties the log, when the program's state is replaced by loading a
+// program or a checkpoint. Execution can't be reversed past this point.
+void undo_reset(Simulator *s) {
+    if (!s->undo) return;
+    s->undo->head = s->undo->len = 0;
+    s->undo->start = s->retired;
+}
+
+// Saves the state that the instruction `d` at `s->pc` is about to change
+void undo_record(Simulator *s, DecodedIns *d) {
+    UndoLog *u = s->undo;
+    UndoEntry *e = &u->entries[(u->head + u->len) % u->cap];
+    if (u->len == u->cap) {
+        u->head = (u->head + 1) % u->cap;
+    } else {
+        u->len++;
+    }
+
+    e->pc = s->pc;
+    e->rd = d->rd;
+    e->size = 0;
+    e->old = s->regs[d->rd];
+    // A store outside memory faults without changing anything
+    if (d->op >= OP_SB && d->op <= OP_SD && s->regs[d->rs1] + d->imm <= MEM_SIZE - (1 << (d->op - OP_SB))) {
+        e->size = 1 << (d->op - OP_SB);
+        e->addr = s->regs[d->rs1] + d->imm;
+        e->old = mem_peek(s, e->addr, e->size);
+    }
+
+    e->stack_len = s->stack->len;
+    e->label = s->stack->len? s->stack->data[s->stack->len - 1].label: NULL;
+    e->line = s->stack->len? s->stack->data[s->stack->len - 1].line: 0;
+}
+
+// Undoes the newest instruction in the log. Returns -1 if the log is
+// empty or has reached the point where it was reset.
+int undo_step(Simulator *s) {
+    UndoLog *u = s->undo;
+    if (!u || !u->len || s->retired <= u->start) return -1;
+    UndoEntry *e = &u->entries[(u->head + --u->len) % u->cap];
+
+    if (e->size) {
+        mem_poke(s, e->addr, e->old, e->size);
+        if (e->addr < s->text_end) sim_redecode(s, e->addr, e->size);
+    } else {
+        s->regs[e->rd] = e->old;
+        s->regs[0] = 0;
+    }
+
+    s->pc = e->pc;
+    s->stack->len = e->stack_len;
+    if (e->stack_len) {
+        s->stack->data[e->stack_len - 1].label = e->label;
+        s->stack->data[e->stack_len - 1].line = e->line;
+    }
+    s->retired--;
+    s->execution_in_progress = 1;
+    return 0;
+}
+
+// Prints the instruction that was undone. Nothing is printed in quiet
+// mode.
+static void print_reversed(Simulator *s) {
+    if (s->quiet) return;
+    printf("Reversed: ");
+    print_line(s->src, get_ins_line(s, s->pc));
+    printf("; PC = 0x%08lx\n", s->pc);
+}
+
+// Undoes one instruction
+void sim_reverse_step(Simulator *s) {
+    if (!s->undo) {
+        printf("Reverse execution is not enabled\n");
+    } else if (undo_step(s) != 0) {
+        printf("Nothing to reverse\n");
+    } else {
+        print_reversed(s);
+    }
+}
+
+// Undoes instructions until the PC reaches a breakpoint or the start of
+// the log
+void sim_reverse_continue(Simulator *s) {
+    if (!s->undo) {
+        printf("Reverse execution is not enabled\n");
+        return;
+    }
+
+    while (undo_step(s) == 0) {
+        print_reversed(s);
+        if (s->pc < s->text_end && s->bp_at[s->pc / 4]) {
+            printf("Reverse execution stopped at breakpoint\n");
+            return;
+        }
+    }
+    printf("Reached the start of the undo log\n");
+}
@@ -0,0 +1,37 @@
+#define UNDO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct Simulator;
+struct DecodedIns;
+
+// Entries kept by default, about 48 MB
+#define UNDO_DEFAULT_ENTRIES (1 << 20)
+
+// What one instruction changed. `old` holds the previous value of `rd`,
+// or the previous bytes at `addr` if the instruction was a store.
+typedef struct UndoEntry {
+    uint64_t pc, old, addr;
+    char *label;       // Top frame of the call stack before the instruction
+    uint32_t stack_len;
+    int32_t line;
+    uint8_t rd, size;  // `size` is the width of a store, 0 otherwise
+} UndoEntry;
+
+// Ring buffer of the most recent instructions. Once it is full, the
+// oldest entries are overwritten, which bounds how far back execution
+// can be reversed.
+typedef struct UndoLog {
+    UndoEntry *entries;
+    size_t cap, head, len;
+    uint64_t start; // `retired` when the log was last reset
+} UndoLog;
+
+void undo_enable(struct Simulator *s, size_t entries);
+void undo_disable(struct Simulator *s);
+void undo_reset(struct Simulator *s);
+void undo_record(struct Simulator *s, struct DecodedIns *d);
+int undo_step(struct Simulator *s);
+void sim_reverse_step(struct Simulator *s);
+void sim_reverse_continue(struct Simulator *s);
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WATCH_H
+#include "watch.h"
+#endif
+
+#ifndef SIMULATOR_H
+#include "simulator.h"
+#endif
+
+#define WATCH_CHUNK_SIZE 64
+
+// Rebuilds the page filter from the watch list. Fusion is disabled
+// while there are watchpoints, so execution stops right after the
+// instruction that made the access.
+static void watch_update(Simulator *s) {
+    memset(s->watch_pages, 0, sizeof(s->watch_pages));
+    for (size_t i = 0; i < s->watches->len; i++) {
+        Watch *w = &s->watches->data[i];
+        uint64_t first = w->addr / WATCH_PAGE_SIZE, last = (w->addr + w->len - 1) / WATCH_PAGE_SIZE;
+        for (uint64_t p = first; p <= last && p - first < WATCH_NUM_PAGES; p++) {
+            s->watch_pages[p % WATCH_NUM_PAGES] = 1;
+        }
+    }
+    if (s->decoded) sim_fuse(s);
+}
+
+// Watches `len` bytes from `addr` for reads, writes or both
+void sim_add_watch(Simulator *s, uint64_t addr, uint64_t len, int mode) {
+    if (len == 0 || addr >= MEM_SIZE || len > MEM_SIZE - addr) {
+        printf("Invalid watchpoint\n");
+        return;
+    }
+
+    WatchVec *v = s->watches;
+    if (v->len == v->cap) {
+        v->data = realloc(v->data, (v->cap + WATCH_CHUNK_SIZE) * sizeof(Watch));
+        v->cap += WATCH_CHUNK_SIZE;
+    }
+    v->data[v->len++] = (Watch){ addr, len, mode };
+    watch_update(s);
+    printf("Watchpoint set at 0x%lx (%lu bytes, %s%s)\n", addr, len,
+        (mode & WATCH_READ)? "r": "", (mode & WATCH_WRITE)? "w": "");
+}
+
+// Removes the watchpoints starting at `addr`
+void sim_remove_watch(Simulator *s, uint64_t addr) {
+    WatchVec *v = s->watches;
+    size_t kept = 0;
+    for (size_t i = 0; i < v->len; i++) {
+        if (v->data[i].addr != addr) v->data[kept++] = v->data[i];
+    }
+
+    if (kept == v->len) {
+        printf("No watchpoint at 0x%lx\n", addr);
+        return;
+    }
+    v->len = kept;
+    watch_update(s);
+    printf("Deleted watchpoint at 0x%lx\n", addr);
+}
+
+// Returns whether an access overlaps a watchpoint for its direction.
+// Only called for accesses to pages that pass the filter.
+int watch_match(Simulator *s, uint64_t addr, size_t num_bytes, int mode) {
+    for (size_t i = 0; i < s->watches->len; i++) {
+        Watch *w = &s->watches->data[i];
+        if ((w->mode & mode) && addr < w->addr + w->len && w->addr < addr + num_bytes) return 1;
+    }
+    return 0;
+}
+
+// Prints the access that stopped execution and clears it
+void watch_report(Simulator *s) {
+    WatchHit *h = &s->watch_hit;
+    if (!h->hit) return;
+    h->hit = 0;
+
+    if (h->is_write) {
+        printf("Watchpoint: write of %zu bytes at 0x%lx: 0x%lx -> 0x%lx\n",
+            h->num_bytes, h->addr, h->old, h->value);
+    } else {
+        printf("Watchpoint: read of %zu bytes at 0x%lx: 0x%lx\n", h->num_bytes, h->addr, h->value);
+    }
+    printf("Line %d: ", get_ins_line(s, h->pc));
+    print_line(s->src, get_ins_line(s, h->pc));
+    printf("; PC = 0x%08lx\n", h->pc);
+}
@@ -0,0 +1,36 @@
+#define WATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct Simulator;
+
+// Watchpoints are looked up through a filter with one counter per page.
+// The number of pages is a power of two, and addresses are folded into
+// it so the filter needs no bounds check.
+#define WATCH_PAGE_SIZE 4096
+#define WATCH_NUM_PAGES 128
+
+enum { WATCH_READ = 1, WATCH_WRITE = 2 };
+
+typedef struct Watch {
+    uint64_t addr, len;
+    int mode;    // WATCH_READ and/or WATCH_WRITE
+} Watch;
+
+typedef struct WatchVec {
+    size_t len, cap;
+    Watch *data;
+} WatchVec;
+
+// The access that triggered a watchpoint
+typedef struct WatchHit {
+    int hit, is_write;
+    uint64_t pc, addr, old, value;
+    size_t num_bytes;
+} WatchHit;
+
+void sim_add_watch(struct Simulator *s, uint64_t addr, uint64_t len, int mode);
+void sim_remove_watch(struct Simulator *s, uint64_t addr);
+int watch_match(struct Simulator *s, uint64_t addr, size_t num_bytes, int mode);
+void watch_report(struct Simulator *s);
@@ -1,16 +1,163 @@
 #! /usr/bin/bash
 
 for i in test/*; do
-    ./riscv_sim >/dev/null <<EOF
-        cache_sim enable $i/config.txt
-        load $i/input.s
-        run
-        exit
-EOF
+    ./riscv_sim --cache $i/config.txt --run $i/input.s --quiet >/dev/null
 
     if cmp -s "$i/expected.output" "$i/input.output"; then
         echo "$i: passed"
     else
         echo "$i: failed"
     fi
-done
\ No newline at end of file
+done
+
+# Assemble every test again with the single-pass assembler
+for i in test/*; do
+    ./riscv_sim --cache $i/config.txt --run $i/input.s --quiet --one-pass >/dev/null
+
+    if cmp -s "$i/expected.output" "$i/input.output"; then
+        echo "$i (one pass): passed"
+    else
+        echo "$i (one pass): failed"
+    fi
+done
+
+# Run every test twice through the assembler cache, so that the second
+# run loads the image stored by the first
+images=$(mktemp -d)
+for i in test/*; do
+    ./riscv_sim --cache $i/config.txt --run $i/input.s --quiet --asm-cache $images >/dev/null
+    ./riscv_sim --cache $i/config.txt --run $i/input.s --quiet --asm-cache $images >/dev/null
+
+    if cmp -s "$i/expected.output" "$i/input.output"; then
+        echo "$i (image cache): passed"
+    else
+        echo "$i (image cache): failed"
+    fi
+done
+
+# Assemble every test into an image and run the image
+for i in test/*; do
+    ./riscv_sim --asm $i/input.s -o $images/input.img
+    ./riscv_sim --cache $i/config.txt --run $images/input.img --quiet >/dev/null
+
+    if cmp -s "$i/expected.output" "$images/input.output"; then
+        echo "$i (image): passed"
+    else
+        echo "$i (image): failed"
+    fi
+    rm -f $images/input.output
+done
+
+# Images whose source lines don't match their source are rejected. The
+# first instruction's line (at the offset stored at byte 96 of the
+# header) and the first byte of the source (byte 112) are overwritten.
+./riscv_sim --asm test/01/input.s -o $images/input.img
+for t in "line:96:\xff\xff\xff\x7f" "source:112:\x00"; do
+    name=${t%%:*}
+    field=${t#*:}
+    cp $images/input.img $images/$name.img
+    offset=$(od -An -t u8 -j ${field%%:*} -N 8 $images/$name.img | tr -d ' ')
+    printf "${field#*:}" | dd of=$images/$name.img bs=1 seek=$offset conv=notrunc 2>/dev/null
+    if [ "$(./riscv_sim --run $images/$name.img --quiet)" = "Invalid program image" ]; then
+        echo "invalid image ($name): passed"
+    else
+        echo "invalid image ($name): failed"
+    fi
+done
+rm -r $images
+
+# Run every test again as one parallel batch, with the cache logs
+# written to a temporary directory
+out=$(mktemp -d)
+for i in test/*; do
+    echo "$i/input.s $i/config.txt $out/$(basename $i).output"
+done > $out/manifest
+
+./riscv_sim --batch $out/manifest >/dev/null
+for i in test/*; do
+    if cmp -s "$i/expected.output" "$out/$(basename $i).output"; then
+        echo "$i (batch): passed"
+    else
+        echo "$i (batch): failed"
+    fi
+done
+rm -r $out
+
+# Record a trace of every test and replay it through the same cache,
+# serially and split over 4 threads, which has to reproduce the cache log
+out=$(mktemp -d)
+for i in test/*; do
+    ./riscv_sim --cache $i/config.txt --run $i/input.s --quiet --trace $out/trace >/dev/null
+    for threads in 1 4; do
+        printf "cache_sim replay $out/trace $i/config.txt $out/replay.output $threads\nexit\n" | ./riscv_sim >/dev/null
+        if cmp -s "$i/expected.output" "$out/replay.output"; then
+            echo "$i (replay, $threads threads): passed"
+        else
+            echo "$i (replay, $threads threads): failed"
+        fi
+    done
+done
+rm -r $out
+
+# Fast-forwarding has to see and update the data held in dirty lines of
+# a write-back cache, so each program has to end with the same registers
+# when run in detail, sampled or run through simpoint
+out=$(mktemp -d)
+echo "64 16 1 LRU WB" > $out/wb.cfg
+# Stores in a detailed window, then loads while fast-forwarding
+printf "lui x6, 0x10\naddi x5, x0, 42\nsd x5, 0(x6)\nld x7, 0(x6)\n" > $out/ff_load.s
+# Caches the line in a detailed window, stores while fast-forwarding,
+# then loads in the next window
+printf "lui x6, 0x10\naddi x5, x0, 42\nld x8, 0(x6)\nsd x5, 0(x6)\nld x7, 0(x6)\n" > $out/ff_store.s
+
+# fast_forward <name> <label> <commands>
+fast_forward() {
+    printf "cache_sim enable $out/wb.cfg\nload $out/$1.s\nrun\nregs\nexit\n" | ./riscv_sim | grep "^x" > $out/expected
+    printf "cache_sim enable $out/wb.cfg\nload $out/$1.s\n$3\nregs\nexit\n" | ./riscv_sim | grep "^x" > $out/actual
+    if [ -s $out/expected ] && cmp -s $out/expected $out/actual; then
+        echo "$1 ($2): passed"
+    else
+        echo "$1 ($2): failed"
+    fi
+}
+fast_forward ff_load sample "sample 0,0,3,5"
+fast_forward ff_store sample "sample 0,0,3,4"
+fast_forward ff_load simpoint "step\nstep\nstep\nsimpoint 1 1"
+
+# A store into the text segment is executed even while it is only in a
+# dirty cache line
+printf "lui x6, 0x2a00\naddi x6, x6, 0x513\nsw x6, 16(x0)\naddi x0, x0, 0\naddi x10, x0, 1\n" > $out/smc.s
+if printf "cache_sim enable $out/wb.cfg\nload $out/smc.s\nrun\nregs\nexit\n" | ./riscv_sim --quiet | grep -q "^x10 = 0x2A$"; then
+    echo "smc (write-back): passed"
+else
+    echo "smc (write-back): failed"
+fi
+rm -r $out
+
+# Run a hand-built RV64I executable (see test_elf/mkelf.py) that uses
+# instructions the assembler doesn't: the 32-bit operations, negative
+# store and jalr offsets, fence and exit
+printf "load test_elf/rv64i.elf\nrun\nregs\nexit\n" | ./riscv_sim --quiet | grep -E "^x|Error" > test_elf/rv64i.output
+if cmp -s test_elf/expected.output test_elf/rv64i.output; then
+    echo "test_elf/rv64i.elf: passed"
+else
+    echo "test_elf/rv64i.elf: failed"
+fi
+rm -f test_elf/rv64i.output
+
+# Accesses outside memory and jumps out of the text segment end the
+# program with a fault instead of crashing the simulator
+out=$(mktemp -d)
+printf "lui x5, 0x80000\nld x6, 0(x5)\n" > $out/access.s
+printf ".data\n.word 0x13\n.text\nlui x5, 0x10\njalr x0, 0(x5)\n" > $out/fetch.s
+for t in "access:Error: Access fault at address 0xffffffff80000000 from PC 0x00000004" \
+         "fetch:Error: Instruction fetch fault at PC 0x00010000"; do
+    name=${t%%:*}
+    output=$(./riscv_sim --run $out/$name.s --quiet)
+    if [ $? -eq 1 ] && [ "$output" = "${t#*:}" ]; then
+        echo "$name fault: passed"
+    else
+        echo "$name fault: failed"
+    fi
+done
+rm -r $out
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+# Writes rv64i.elf, a statically linked RV64I executable for test.sh. It
+# exercises the 32-bit (W) operations, negative store and jalr offsets,
+# logical shifts of negative values, fence and the exit system call.
+# Built by hand so the test doesn't need a RISC-V toolchain.
+
+import struct
+
+def r(f7, rs2, rs1, f3, rd, op): return f7 << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op
+def i(imm, rs1, f3, rd, op): return (imm & 0xfff) << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op
+def s(imm, rs2, rs1, f3): return (imm >> 5 & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | (imm & 0x1f) << 7 | 0x23
+def u(imm, rd, op): return (imm & 0xfffff) << 12 | rd << 7 | op
+
+sp, s0, t0, t1, t2, t3, t4, t5, t6 = 2, 8, 5, 6, 7, 28, 29, 30, 31
+a0, a1, a2, a3, a4, a5, a6, a7 = range(10, 18)
+s1, s2, s3, s4, s5, s6 = 9, 18, 19, 20, 21, 22
+
+text = [
+    i(-32, sp, 0, sp, 0x13),        # 0x00 addi sp, sp, -32
+    i(32, sp, 0, s0, 0x13),         # 0x04 addi s0, sp, 32
+    u(0x80000, t0, 0x37),           # 0x08 lui t0, 0x80000
+    i(-1, t0, 0, t1, 0x1b),         # 0x0c addiw t1, t0, -1
+    i(1, t1, 0, t2, 0x1b),          # 0x10 addiw t2, t1, 1
+    r(0, t1, t1, 0, t3, 0x3b),      # 0x14 addw t3, t1, t1
+    r(0x20, t1, t0, 0, t4, 0x3b),   # 0x18 subw t4, t0, t1
+    i(4, t1, 1, t5, 0x1b),          # 0x1c slliw t5, t1, 4
+    i(4, t0, 5, t6, 0x1b),          # 0x20 srliw t6, t0, 4
+    i(0x400 | 4, t0, 5, a1, 0x1b),  # 0x24 sraiw a1, t0, 4
+    i(36, 0, 0, a2, 0x13),          # 0x28 addi a2, x0, 36
+    r(0, a2, t1, 1, a3, 0x3b),      # 0x2c sllw a3, t1, a2
+    r(0x20, a2, t0, 5, a4, 0x3b),   # 0x30 sraw a4, t0, a2
+    i(60, t0, 5, a5, 0x13),         # 0x34 srli a5, t0, 60
+    i(-1, 0, 3, a6, 0x13),          # 0x38 sltiu a6, x0, -1
+    s(-24, t1, s0, 3),              # 0x3c sd t1, -24(s0)
+    s(-8, t0, s0, 2),               # 0x40 sw t0, -8(s0)
+    i(-24, s0, 3, s1, 0x03),        # 0x44 ld s1, -24(s0)
+    i(-8, s0, 2, s2, 0x03),         # 0x48 lw s2, -8(s0)
+    0x0ff0000f,                     # 0x4c fence
+    u(0, s3, 0x17),                 # 0x50 auipc s3, 0
+    i(24, s3, 0, s3, 0x13),         # 0x54 addi s3, s3, 24
+    i(-4, s3, 0, s4, 0x67),         # 0x58 jalr s4, -4(s3)
+    i(1, 0, 0, s5, 0x13),           # 0x5c addi s5, x0, 1 (skipped)
+    i(2, 0, 0, s5, 0x13),           # 0x60 addi s5, x0, 2 (skipped)
+    i(3, 0, 0, s6, 0x13),           # 0x64 addi s6, x0, 3
+    i(93, 0, 0, a7, 0x13),          # 0x68 addi a7, x0, 93
+    i(7, 0, 0, a0, 0x13),           # 0x6c addi a0, x0, 7
+    0x00000073,                     # 0x70 ecall
+    0xffffffff,                     # 0x74 illegal, never reached
+]
+code = b''.join(struct.pack('<I', w) for w in text)
+
+# One executable segment at address 0, the symbol `_start` and no
+# section headers besides the symbol and string tables
+shstrtab = b'\0.text\0.symtab\0.strtab\0.shstrtab\0'
+strtab = b'\0_start\0'
+symtab = b'\0' * 24 + struct.pack('<IBBHQQ', 1, 0x12, 0, 1, 0, len(code))
+text_off = 0x1000
+sym_off = text_off + len(code)
+str_off = sym_off + len(symtab)
+shstr_off = str_off + len(strtab)
+sh_off = (shstr_off + len(shstrtab) + 7) & ~7
+
+def sh(name, kind, off, size, link=0, entsize=0, flags=0):
+    return struct.pack('<IIQQQQIIQQ', name, kind, flags, 0, off, size, link, 0, 8, entsize)
+
+out = bytearray(sh_off)
+out[0:64] = struct.pack('<16sHHIQQQIHHHHHH', b'\x7fELF\x02\x01\x01' + b'\0' * 9,
+                        2, 243, 1, 0, 64, sh_off, 0, 64, 56, 1, 64, 5, 4)
+out[64:120] = struct.pack('<IIQQQQQQ', 1, 5, text_off, 0, 0, len(code), len(code), 0x1000)
+out[text_off:sym_off] = code
+out[sym_off:str_off] = symtab
+out[str_off:shstr_off] = strtab
+out[shstr_off:shstr_off + len(shstrtab)] = shstrtab
+out += sh(0, 0, 0, 0) + sh(1, 1, text_off, len(code), flags=6) + sh(7, 2, sym_off, len(symtab), 3, 24) \
+    + sh(15, 3, str_off, len(strtab)) + sh(23, 3, shstr_off, len(shstrtab))
+open('rv64i.elf', 'wb').write(out)